@@ -0,0 +1,33 @@
+#include "bench.h"
+#include <cstdlib>
+#include <new>
+
+std::atomic<uint64_t> bench::allocations{0};
+
+auto operator new(size_t size) -> void* {
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto const ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+auto operator new[](size_t size) -> void* {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
@@ -0,0 +1,83 @@
+#include "bench.h"
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <filesystem>
+#include <unistd.h>
+
+namespace bench {
+
+void report(std::string const& name, Result const& result) {
+    printf("%-56s %12.1f ns/op %10.2f allocs/op\n", name.c_str(), result.ns_per_op, result.allocs_per_op);
+    fflush(stdout);
+}
+
+auto synthetic_names(int count) -> std::vector<std::string> {
+    static char const* const real_names[] = {
+        "wl_compositor",
+        "wl_shm",
+        "wl_seat",
+        "wl_output",
+        "xdg_wm_base",
+        "zwlr_layer_shell_v1",
+        "zwlr_data_control_manager_v1",
+        "zwp_primary_selection_device_manager_v1",
+    };
+    std::vector<std::string> names;
+    for (int i = 0; i < count; i++) {
+        if (i < static_cast<int>(std::size(real_names))) {
+            names.push_back(real_names[i]);
+        } else {
+            names.push_back("zbench_interface_" + std::to_string(i) + "_v1");
+        }
+    }
+    return names;
+}
+
+auto synthetic_config(
+    int directives,
+    std::vector<std::string> const& names,
+    unsigned seed,
+    bool permissive
+) -> std::string {
+    auto const path = std::filesystem::temp_directory_path() /
+        ("wlbouncer-bench-" + std::to_string(getpid()) + "-" + std::to_string(directives) + "-" +
+         std::to_string(names.size()) + ".yaml");
+    std::mt19937 rng{seed};
+    std::ofstream out{path};
+    out << "version: 0\npolicy:\n";
+    if (permissive) {
+        out << "  - enable: all\n";
+    }
+    for (int i = 0; i < directives; i++) {
+        auto const roll = rng() % 100;
+        // Mostly conditional fallthrough directives, so checks have to look at many of them
+        std::string condition;
+        if (roll < 40) {
+            condition = "  - uid: " + std::to_string(1000 + rng() % 20) + "\n";
+        } else if (roll < 60) {
+            condition = "  - users: [root, nobody]\n";
+        } else if (roll < 75) {
+            condition = "  - pid: $PARENT_PID\n";
+        } else if (roll < 85) {
+            condition = "  - gid: $SELF_GID\n";
+        } else {
+            condition = "  -\n";
+        }
+        auto const kind = rng() % 100;
+        // Only conditions that can not match the benchmark's own clients, which may run as root, may disable anything
+        if (permissive && kind >= 45 && roll >= 40) {
+            condition = roll < 60 ? "  - users: [nobody, daemon]\n" : "  - pid: $PARENT_PID\n";
+        }
+        out << condition;
+        out << "    " << (kind < 45 ? "enable" : kind < 90 ? "disable" : kind < 95 ? "enable-only" : "disable-only")
+            << ":\n";
+        auto const count = 1 + rng() % 8;
+        for (unsigned j = 0; j < count; j++) {
+            out << "      - " << names[rng() % names.size()] << "\n";
+        }
+    }
+    return path;
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef WL_BOUNCER_BENCH_H
+#define WL_BOUNCER_BENCH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/// Incremented by the replaced operator new in alloc_counter.cpp
+extern std::atomic<uint64_t> allocations;
+
+struct Result {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+/// Accumulates time and allocations between start() and stop()
+class Stopwatch {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start() {
+        allocs_before = allocations.load(std::memory_order_relaxed);
+        started = Clock::now();
+    }
+
+    void stop() {
+        elapsed += Clock::now() - started;
+        allocs += allocations.load(std::memory_order_relaxed) - allocs_before;
+    }
+
+    Clock::duration elapsed{};
+    uint64_t allocs = 0;
+
+private:
+    Clock::time_point started;
+    uint64_t allocs_before = 0;
+};
+
+/// Calls batch(stopwatch), which times the part it cares about and returns how many operations that was, until
+/// enough time has been measured and at least min_batches have run
+template<typename F>
+auto measure_region(
+    F&& batch,
+    std::chrono::nanoseconds min_time = std::chrono::milliseconds{200},
+    int min_batches = 1
+) -> Result {
+    Stopwatch stopwatch;
+    uint64_t ops = 0;
+    for (int batches = 0; batches < min_batches || stopwatch.elapsed < min_time; batches++) {
+        ops += batch(stopwatch);
+    }
+    return Result{
+        static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(stopwatch.elapsed).count()) / ops,
+        static_cast<double>(stopwatch.allocs) / ops,
+    };
+}
+
+/// Calls batch(), which returns how many operations it ran, until enough time has passed
+template<typename F>
+auto measure(F&& batch, std::chrono::nanoseconds min_time = std::chrono::milliseconds{200}) -> Result {
+    return measure_region([&](Stopwatch& stopwatch) {
+        stopwatch.start();
+        auto const ops = batch();
+        stopwatch.stop();
+        return ops;
+    }, min_time);
+}
+
+void report(std::string const& name, Result const& result);
+
+/// Interface names for synthetic globals, the first few are real names that are enabled by default
+auto synthetic_names(int count) -> std::vector<std::string>;
+
+/// Writes a config with the given number of directives mentioning the given names, returns its path. A permissive
+/// config still has to be evaluated in full, but enables every global for clients with any UID outside 1000 to 1019
+/// and any PID but the benchmark's parent's, unless they run as nobody or daemon.
+auto synthetic_config(
+    int directives,
+    std::vector<std::string> const& names,
+    unsigned seed,
+    bool permissive = false) -> std::string;
+
+}
+
+#endif // WL_BOUNCER_BENCH_H
@@ -0,0 +1,262 @@
+#include "bench.h"
+#include "name_resolver.h"
+#include "wlbouncer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <pwd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+// Connects thousands of in-process clients to a headless display in bursts and measures how long each takes to
+// get through a full registry round trip, with and without wlbouncer. Clients speak the wire protocol directly so
+// nothing but libwayland-server is needed. Each client claims its own PID and each burst another user, so wlbouncer
+// classifies them like clients of separate processes rather than as the compositor itself.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    int clients = 5000;
+    int globals = 300;
+    int burst = 250;
+    int directives = 100;
+};
+
+struct Credentials {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+/// What the next client created connects as, see wl_client_get_credentials()
+Credentials next_credentials;
+
+/// Above the kernel's largest PID, so no directive or /proc lookup can mistake a client for a real process
+constexpr pid_t first_client_pid = 1 << 22;
+
+/// Accounts of this system for the bursts to connect as in turn, without the users and UIDs that the permissive
+/// synthetic_config() disables globals for, so every client still sees every global
+auto client_accounts() -> std::vector<Credentials> {
+    std::vector<Credentials> accounts;
+    setpwent();
+    while (auto const entry = getpwent()) {
+        std::string const name = entry->pw_name;
+        if (name != "nobody" && name != "daemon" && (entry->pw_uid < 1000 || entry->pw_uid >= 1020)) {
+            accounts.push_back({0, entry->pw_uid, entry->pw_gid});
+        }
+    }
+    endpwent();
+    if (accounts.empty()) {
+        accounts.push_back({0, getuid(), getgid()});
+    }
+    return accounts;
+}
+
+void bind_nothing(wl_client*, void*, uint32_t, uint32_t) {}
+
+/// The client end of one connection
+struct Connection {
+    wl_client* client;
+    int fd;
+    Clock::time_point start;
+    std::vector<char> buffer;
+    int globals_seen = 0;
+    bool done = false;
+
+    /// Sends wl_display.get_registry(2) followed by wl_display.sync(3)
+    void request_registry() {
+        uint32_t const message[] = {
+            1, (12u << 16) | 1, 2,
+            1, (12u << 16) | 0, 3,
+        };
+        if (write(fd, message, sizeof(message)) != sizeof(message)) {
+            perror("write");
+            exit(1);
+        }
+    }
+
+    /// Reads whatever is available, returns true once the sync callback is done
+    auto read_events() -> bool {
+        char chunk[16384];
+        ssize_t len;
+        while ((len = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+            buffer.insert(buffer.end(), chunk, chunk + len);
+        }
+        size_t offset = 0;
+        while (offset + 8 <= buffer.size()) {
+            uint32_t header[2];
+            memcpy(header, &buffer[offset], sizeof(header));
+            auto const size = header[1] >> 16;
+            auto const opcode = header[1] & 0xffff;
+            if (size < 8 || offset + size > buffer.size()) {
+                break;
+            }
+            if (header[0] == 2 && opcode == 0) {
+                globals_seen++;
+            } else if (header[0] == 3 && opcode == 0) {
+                done = true;
+            }
+            offset += size;
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + offset);
+        return done;
+    }
+};
+
+struct RunResult {
+    std::vector<Clock::duration> latencies;
+    double bytes_per_client;
+    double globals_per_client;
+};
+
+auto run(
+    Options const& options,
+    std::vector<Credentials> const& accounts,
+    std::optional<std::string> const& config
+) -> RunResult {
+    auto const display = wl_display_create();
+    auto const loop = wl_display_get_event_loop(display);
+    if (config) {
+        wl_bouncer_init_for_display(display, config->c_str(), nullptr, nullptr);
+    }
+    auto const names = bench::synthetic_names(options.globals);
+    std::vector<wl_interface> interfaces;
+    for (auto const& name : names) {
+        interfaces.push_back(wl_interface{name.c_str(), 1, 0, nullptr, 0, nullptr});
+    }
+    std::vector<wl_global*> globals;
+    for (auto const& interface : interfaces) {
+        globals.push_back(wl_global_create(display, &interface, 1, nullptr, bind_nothing));
+        if (config) {
+            wl_bouncer_global_created(globals.back());
+        }
+    }
+
+    RunResult result{};
+    std::vector<Connection> connections;
+    connections.reserve(options.clients);
+    auto const heap_before = mallinfo2().uordblks;
+    for (int first = 0; first < options.clients; first += options.burst) {
+        auto const last = std::min(first + options.burst, options.clients);
+        auto const& account = accounts[first / options.burst % accounts.size()];
+        for (int i = first; i < last; i++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+                perror("socketpair");
+                exit(1);
+            }
+            next_credentials = {first_client_pid + i, account.uid, account.gid};
+            auto const start = Clock::now();
+            connections.push_back(Connection{wl_client_create(display, fds[0]), fds[1], start, {}});
+            connections.back().request_registry();
+        }
+        auto pending = last - first;
+        while (pending) {
+            wl_event_loop_dispatch(loop, 0);
+            wl_display_flush_clients(display);
+            for (int i = first; i < last; i++) {
+                auto& connection = connections[i];
+                if (!connection.done && connection.read_events()) {
+                    result.latencies.push_back(Clock::now() - connection.start);
+                    pending--;
+                }
+            }
+        }
+    }
+    auto const heap_after = mallinfo2().uordblks;
+    result.bytes_per_client = static_cast<double>(heap_after - heap_before) / options.clients;
+    double globals_seen = 0;
+    for (auto& connection : connections) {
+        globals_seen += connection.globals_seen;
+        wl_client_destroy(connection.client);
+        close(connection.fd);
+    }
+    result.globals_per_client = globals_seen / options.clients;
+    for (auto const global : globals) {
+        if (config) {
+            wl_bouncer_global_destroyed(global);
+        }
+        wl_global_destroy(global);
+    }
+    wl_display_destroy(display);
+    return result;
+}
+
+auto percentile(std::vector<Clock::duration> sorted, double p) -> double {
+    auto const index = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return std::chrono::duration<double, std::micro>(sorted[index]).count();
+}
+
+void report(std::string const& label, RunResult result) {
+    std::sort(result.latencies.begin(), result.latencies.end());
+    printf("%-12s p50 %8.1f us  p99 %8.1f us  p999 %8.1f us  %8.0f bytes/client  %6.1f globals/client\n",
+        label.c_str(),
+        percentile(result.latencies, 0.5),
+        percentile(result.latencies, 0.99),
+        percentile(result.latencies, 0.999),
+        result.bytes_per_client,
+        result.globals_per_client);
+    fflush(stdout);
+}
+
+auto parse_options(int argc, char** argv) -> Options {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string const arg = argv[i];
+        auto const value = atoi(argv[i + 1]);
+        if (arg == "--clients") {
+            options.clients = value;
+        } else if (arg == "--globals") {
+            options.globals = value;
+        } else if (arg == "--burst") {
+            options.burst = value;
+        } else if (arg == "--directives") {
+            options.directives = value;
+        } else {
+            fprintf(stderr, "usage: %s [--clients N] [--globals N] [--burst N] [--directives N]\n", argv[0]);
+            exit(1);
+        }
+    }
+    return options;
+}
+
+}
+
+/// Replaces libwayland's, so wlbouncer sees each client as next_credentials
+extern "C" void wl_client_get_credentials(wl_client*, pid_t* pid, uid_t* uid, gid_t* gid) {
+    *pid = next_credentials.pid;
+    *uid = next_credentials.uid;
+    *gid = next_credentials.gid;
+}
+
+auto main(int argc, char** argv) -> int {
+    auto const options = parse_options(argc, argv);
+    auto const accounts = client_accounts();
+    printf("%d clients in bursts of %d as %zu users, %d globals, %d directives\n",
+        options.clients, options.burst, accounts.size(), options.globals, options.directives);
+    auto const config = bench::synthetic_config(
+        options.directives, bench::synthetic_names(options.globals), options.directives, true);
+    // Limits no burst reaches, so every connection pays for its bucket lookups without being rejected
+    std::ofstream{config, std::ios::app} << "rate-limit:\n  uid: {rate: 1000000}\n  pid: {rate: 1000000}\n";
+    // Names are looked up before timing, so no client waits on a lookup
+    for (auto const& account : accounts) {
+        NameResolver::get().user_now(account.uid);
+        NameResolver::get().group_now(account.gid);
+    }
+    auto const plain = run(options, accounts, std::nullopt);
+    auto const bouncer = run(options, accounts, config);
+    std::filesystem::remove(config);
+    report("libwayland", plain);
+    report("wlbouncer", bouncer);
+}
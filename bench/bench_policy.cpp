@@ -0,0 +1,271 @@
+#include "bench.h"
+#include "policy.h"
+#include "class_table.h"
+#include "name_resolver.h"
+#include "wlbouncer.h"
+#include <cstdio>
+#include <memory>
+#include <filesystem>
+#include <fstream>
+#include <sys/socket.h>
+#include <wayland-server-core.h>
+
+extern void (*real_wl_display_set_global_filter)(
+    wl_display* display,
+    wl_display_global_filter_func_t filter,
+    void* data
+);
+
+namespace {
+
+/// What every client of a Display connects as instead of the benchmark's own credentials, which would make it the
+/// compositor itself and have the defaults allow it everything. The IDs are nobody's, so users conditions can match.
+constexpr pid_t client_pid = 54321;
+constexpr uid_t client_uid = 65534;
+constexpr gid_t client_gid = 65534;
+
+wl_display_global_filter_func_t captured_filter = nullptr;
+void* captured_filter_data = nullptr;
+
+void capture_filter(wl_display*, wl_display_global_filter_func_t filter, void* data) {
+    captured_filter = filter;
+    captured_filter_data = data;
+}
+
+void bind_nothing(wl_client*, void*, uint32_t, uint32_t) {}
+
+/// A real display with wlbouncer's filter, one global per name and one connected client
+struct Display {
+    Display(std::string const& config, std::vector<wl_interface> const& interfaces, bool track_globals) :
+        display{wl_display_create()}
+    {
+        real_wl_display_set_global_filter = capture_filter;
+        wl_bouncer_init_for_display(display, config.c_str(), nullptr, nullptr);
+        filter = captured_filter;
+        filter_data = captured_filter_data;
+        for (auto const& interface : interfaces) {
+            globals.push_back(wl_global_create(display, &interface, 1, nullptr, bind_nothing));
+            if (track_globals) {
+                wl_bouncer_global_created(globals.back());
+            }
+        }
+        // Cached names, so the client is classified as it connects rather than left waiting on a lookup
+        NameResolver::get().user_now(client_uid);
+        NameResolver::get().group_now(client_gid);
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+        client = wl_client_create(display, fds[0]);
+        client_fd = fds[1];
+    }
+
+    ~Display() {
+        wl_client_destroy(client);
+        close(client_fd);
+        for (auto const global : globals) {
+            wl_bouncer_global_destroyed(global);
+            wl_global_destroy(global);
+        }
+        wl_display_destroy(display);
+    }
+
+    /// Runs the filter once for every global, returns how many were allowed
+    auto filter_all() -> int {
+        int allowed = 0;
+        for (auto const global : globals) {
+            allowed += filter(client, global, filter_data);
+        }
+        return allowed;
+    }
+
+    wl_display* const display;
+    wl_display_global_filter_func_t filter;
+    void* filter_data;
+    std::vector<wl_global*> globals;
+    wl_client* client;
+    int client_fd;
+};
+
+auto make_interfaces(std::vector<std::string> const& names) -> std::vector<wl_interface> {
+    std::vector<wl_interface> interfaces;
+    for (auto const& name : names) {
+        interfaces.push_back(wl_interface{name.c_str(), 1, 0, nullptr, 0, nullptr});
+    }
+    return interfaces;
+}
+
+volatile int sink;
+
+void bench_check(std::string const& label, Policy const& policy, std::vector<std::string> const& names) {
+    std::vector<InterfaceId> ids;
+    for (auto const& name : names) {
+        ids.push_back(policy.find_interface(name));
+    }
+    auto const client = policy.client(54321, 1005, 1005, "nobody", "nogroup");
+    bench::report("Policy::check " + label, bench::measure([&]() {
+        int allowed = 0;
+        for (auto const id : ids) {
+            allowed += policy.check(*client, id);
+        }
+        sink = allowed;
+        return ids.size();
+    }));
+}
+
+void bench_load(std::string const& label, std::string const& config) {
+    auto const load = [&]() {
+        Policy const policy{config.c_str()};
+        sink = policy.ok();
+        return size_t{1};
+    };
+    bench::report("Policy load yaml " + label, bench::measure(load));
+    auto const compiled = Policy::compiled_path(config);
+    Policy{config.c_str()}.save_compiled(compiled);
+    bench::report("Policy load compiled " + label, bench::measure(load));
+    std::filesystem::remove(compiled);
+}
+
+struct HotplugClass {
+    std::shared_ptr<Policy::Client const> client;
+    size_t table_row;
+};
+
+/// Deciding a newly created global for every class at once, one check() per class against one pass over the class
+/// table
+void bench_hotplug(std::string const& label, Policy const& policy, std::vector<std::string> const& names) {
+    int const class_count = 300;
+    std::vector<HotplugClass> classes(class_count);
+    ClassTable<HotplugClass> table{policy.directive_count()};
+    for (int i = 0; i < class_count; i++) {
+        auto const uid = static_cast<uid_t>(1000 + i);
+        classes[i].client = policy.client(60000 + i, uid, uid, "nobody", "nogroup");
+        table.add(&classes[i], *classes[i].client);
+    }
+    std::vector<InterfaceId> ids;
+    for (auto const& name : names) {
+        ids.push_back(policy.find_interface(name));
+    }
+    auto const suffix = " " + std::to_string(class_count) + " classes, " + label;
+    bench::report("global created check() per class" + suffix, bench::measure([&]() {
+        int allowed = 0;
+        for (auto const id : ids) {
+            for (auto const& hotplug_class : classes) {
+                allowed += policy.check(*hotplug_class.client, id);
+            }
+        }
+        sink = allowed;
+        return ids.size();
+    }));
+    bench::report("global created class table pass" + suffix, bench::measure([&]() {
+        int allowed = 0;
+        for (auto const id : ids) {
+            table.decide_all(policy.deciders_for(id), [&](HotplugClass*, Policy::Verdict const& verdict) {
+                allowed += verdict.allowed;
+            });
+        }
+        sink = allowed;
+        return ids.size();
+    }));
+}
+
+/// A config split into fragments in its drop-in directory, reloaded after touching all of them or just one
+void bench_dropins(int fragment_count, std::vector<std::string> const& names) {
+    auto const config = std::filesystem::temp_directory_path() /
+        ("wlbouncer-bench-" + std::to_string(getpid()) + "-dropins.yaml");
+    std::ofstream{config} << "version: 0\npolicy: []\n";
+    auto const dropins = std::filesystem::path{Policy::dropin_path(config)};
+    std::filesystem::create_directory(dropins);
+    std::vector<std::filesystem::path> fragments;
+    for (int i = 0; i < fragment_count; i++) {
+        auto const fragment = bench::synthetic_config(10, names, i);
+        char name[32];
+        snprintf(name, sizeof(name), "%04d.yaml", i);
+        fragments.push_back(dropins / name);
+        std::filesystem::rename(fragment, fragments.back());
+    }
+    auto const label = std::to_string(fragment_count) + " drop-in fragments";
+    for (auto const touch_all : {true, false}) {
+        int reloads = 0;
+        bench::report(
+            std::string{"Policy reload "} + (touch_all ? "all changed, " : "1 changed, ") + label,
+            bench::measure_region([&](bench::Stopwatch& stopwatch) {
+                auto const now = std::filesystem::file_time_type::clock::now();
+                for (size_t i = 0; i < fragments.size(); i++) {
+                    if (touch_all || i == static_cast<size_t>(reloads) % fragments.size()) {
+                        std::filesystem::last_write_time(fragments[i], now);
+                    }
+                }
+                reloads++;
+                stopwatch.start();
+                Policy const policy{config.c_str()};
+                stopwatch.stop();
+                sink = policy.ok();
+                return size_t{1};
+            }, std::chrono::milliseconds{200}, 3));
+    }
+    std::filesystem::remove_all(dropins);
+    std::filesystem::remove(config);
+}
+
+void bench_filter(std::string const& label, std::string const& config, std::vector<std::string> const& names) {
+    auto const interfaces = make_interfaces(names);
+    // Cold: each pass is the first registry of the first client of its class on a fresh display, which has to load
+    // the config, so only a few passes are run
+    bench::report("filter_func cold " + label, bench::measure_region([&](bench::Stopwatch& stopwatch) {
+        Display display{config, interfaces, false};
+        stopwatch.start();
+        sink = display.filter_all();
+        stopwatch.stop();
+        return display.globals.size();
+    }, std::chrono::nanoseconds{0}, 5));
+    for (auto const track_globals : {false, true}) {
+        Display display{config, interfaces, track_globals};
+        display.filter_all();
+        bench::report(
+            std::string{"filter_func warm "} + (track_globals ? "tracked " : "untracked ") + label,
+            bench::measure([&]() {
+                sink = display.filter_all();
+                return display.globals.size();
+            }));
+    }
+    Display display{config, interfaces, true};
+    std::vector<wl_bouncer_interface const*> handles;
+    for (auto const& name : names) {
+        handles.push_back(wl_bouncer_resolve_interface(name.c_str()));
+    }
+    bench::report("wl_bouncer_query warm " + label, bench::measure([&]() {
+        int allowed = 0;
+        for (auto const handle : handles) {
+            allowed += wl_bouncer_query(display.display, display.client, handle);
+        }
+        sink = allowed;
+        return handles.size();
+    }));
+}
+
+}
+
+/// Replaces libwayland's, so wlbouncer sees the clients of a Display as client_pid, client_uid and client_gid
+extern "C" void wl_client_get_credentials(wl_client*, pid_t* pid, uid_t* uid, gid_t* gid) {
+    *pid = client_pid;
+    *uid = client_uid;
+    *gid = client_gid;
+}
+
+auto main() -> int {
+    for (auto const name_count : {50, 500}) {
+        auto const names = bench::synthetic_names(name_count);
+        for (auto const directive_count : {10, 100, 1000, 5000}) {
+            auto const label = std::to_string(directive_count) + " directives, " + std::to_string(name_count) + " names";
+            auto const config = bench::synthetic_config(directive_count, names, directive_count * 31 + name_count);
+            {
+                Policy const policy{config.c_str()};
+                bench_check(label, policy, names);
+                bench_hotplug(label, policy, names);
+            }
+            bench_load(label, config);
+            bench_filter(label, config, names);
+            std::filesystem::remove(config);
+        }
+    }
+    bench_dropins(300, bench::synthetic_names(50));
+}
@@ -1,8 +1,13 @@
 #ifndef WL_BOUNCER_H
 #define WL_BOUNCER_H
 
+#include <stdint.h>
+
 extern "C" {
 struct wl_display;
+struct wl_global;
+struct wl_client;
+struct wl_bouncer_interface;
 
 typedef bool (*wl_display_global_filter_func_t)(
     const struct wl_client *client,
@@ -19,6 +24,143 @@ void wl_bouncer_init_for_display(
     const char* config_file,
     wl_display_global_filter_func_t filter,
     void* filter_data);
+
+/// Like wl_bouncer_init_for_display(), but loads the policy on a background thread instead of blocking. Until it is
+/// loaded globals are filtered by the built-in defaults, or denied entirely if fail_closed is set. Clients that
+/// connect in the meantime are re-evaluated once the policy is in place and told about globals it allows them, which
+/// requires reporting globals with wl_bouncer_global_created(). The config file is searched for before returning.
+/// display: the Wayland display to filter globals for, whose event loop receives the loaded policy
+/// config_file: the config file to load, or null to use default config file discovery
+/// filter: an additional filter to use, or null
+/// filter_data: the data argument for the filter function
+/// fail_closed: deny every global until the policy is loaded, rather than allowing the built-in defaults
+void wl_bouncer_init_for_display_async(
+    wl_display* display,
+    const char* config_file,
+    wl_display_global_filter_func_t filter,
+    void* filter_data,
+    bool fail_closed);
+
+/// Flags for wl_bouncer_init_for_display_with_flags()
+enum wl_bouncer_init_flags {
+    /// Load the policy on a background thread, see wl_bouncer_init_for_display_async()
+    WL_BOUNCER_INIT_ASYNC = 1 << 0,
+    /// With WL_BOUNCER_INIT_ASYNC, deny every global until the policy is loaded
+    WL_BOUNCER_INIT_FAIL_CLOSED = 1 << 1,
+    /// The filter returns the same result for the same client and global until wl_bouncer_invalidate() is called,
+    /// so its result is kept for each client and global passed to wl_bouncer_global_created() instead of calling it
+    /// on every filter call
+    WL_BOUNCER_INIT_FILTER_PURE = 1 << 2,
+};
+
+/// Like wl_bouncer_init_for_display(), with behavior chosen by flags
+/// display: the Wayland display to filter globals for
+/// config_file: the config file to load, or null to use default config file discovery
+/// filter: an additional filter to use, or null
+/// filter_data: the data argument for the filter function
+/// flags: a combination of wl_bouncer_init_flags
+void wl_bouncer_init_for_display_with_flags(
+    wl_display* display,
+    const char* config_file,
+    wl_display_global_filter_func_t filter,
+    void* filter_data,
+    uint32_t flags);
+
+/// Forgets what a filter passed with WL_BOUNCER_INIT_FILTER_PURE returned, to be called when the state it depends on
+/// changes. Does not tell clients about globals this makes visible or hidden, the compositor must do that as it would
+/// without wlbouncer.
+/// display: a display wlbouncer was initialized for
+/// client: the client whose results to forget, or null for all clients
+void wl_bouncer_invalidate(struct wl_display* display, const struct wl_client* client);
+
+/// Should be called after each successful wl_global_create() (the preloaded library does this automatically)
+/// Lets wlbouncer decide on the global once instead of looking up its interface on every filter call, and tell clients
+/// about it when their decisions change. Until any global is reported, user and group names are looked up on the
+/// display's thread rather than in the background, since clients could not be told about globals afterwards. Required
+/// for connected clients to see the effect of a reloaded or asynchronously loaded policy on their registries.
+/// global: the newly created global
+void wl_bouncer_global_created(struct wl_global* global);
+
+/// Should be called before each wl_global_destroy() for globals passed to wl_bouncer_global_created()
+/// global: the global about to be destroyed
+void wl_bouncer_global_destroyed(struct wl_global* global);
+
+/// Returns a handle for wl_bouncer_query() to look up an interface by, the same one for the same name. Handles are
+/// valid for the life of the process and work with every display. Can be called from any thread, ideally once per
+/// interface at startup.
+/// name: an interface name, such as "zwlr_screencopy_manager_v1"
+/// returns: null if name is null
+const struct wl_bouncer_interface* wl_bouncer_resolve_interface(const char* name);
+
+/// Whether the policy allows the client the interface, for gating binds and requests the same way globals are
+/// filtered. Answers from the same cache as the global filter without allocating or hashing names, so it is cheap
+/// enough for every request of a hot protocol handler. Only the first query of a handle on a display (and the first
+/// after each policy reload) looks its name up. The compositor's own filter is not consulted. Must be called from
+/// the display's thread.
+/// display: a display wlbouncer was initialized for
+/// client: a client of the display
+/// interface: from wl_bouncer_resolve_interface()
+/// returns: false if the policy denies the interface, if the client has no decisions yet (its user or group name is
+/// still being looked up, or could not be), if the client belongs to another display or if wlbouncer is not filtering
+/// the display
+bool wl_bouncer_query(
+    struct wl_display* display,
+    const struct wl_client* client,
+    const struct wl_bouncer_interface* interface);
+
+#define WL_BOUNCER_HISTOGRAM_BUCKETS 32
+
+/// Counters for a display, see wl_bouncer_get_stats(). Fields are only ever added at the end, so callers built
+/// against an older version of this header keep working.
+struct wl_bouncer_stats {
+    /// Set to sizeof(struct wl_bouncer_stats) before calling wl_bouncer_get_stats(), which only fills in that many
+    /// bytes and sets it to how many it filled in
+    uint32_t struct_size;
+    uint64_t filter_calls;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t allowed;
+    uint64_t denied;
+    uint64_t clients_created;
+    uint64_t clients_destroyed;
+    /// Number of times a policy was loaded (initially and on each reload) and how long the last load took
+    uint64_t policy_loads;
+    uint64_t policy_load_ns;
+    /// User and group name lookups, shared by all displays in the process
+    uint64_t name_lookups;
+    uint64_t name_lookup_ns;
+    /// Bucket i counts calls that took between 2^i and 2^(i+1) nanoseconds, the last bucket counts everything longer
+    /// Only one in every 64 filter calls is timed
+    uint64_t filter_latency[WL_BOUNCER_HISTOGRAM_BUCKETS];
+    uint64_t client_created_latency[WL_BOUNCER_HISTOGRAM_BUCKETS];
+    /// Clients disconnected for connecting faster than the policy's rate-limit allows, also counted as created
+    uint64_t clients_rejected;
+    /// Calls to the compositor's own filter, fewer than filter_calls if it was declared pure
+    uint64_t chained_filter_calls;
+    /// Calls to wl_bouncer_query(), which are not counted in filter_calls, allowed or denied
+    uint64_t queries;
+};
+
+/// Can be called from any thread, even while the display is being destroyed on its own
+/// display: a display wlbouncer was initialized for
+/// stats: filled in with the display's counters, up to its struct_size
+/// returns: false if wlbouncer is not filtering the display or struct_size is too small for any counter
+bool wl_bouncer_get_stats(struct wl_display* display, struct wl_bouncer_stats* stats);
+
+typedef void (*wl_bouncer_interface_stats_func_t)(
+    const char* interface,
+    uint64_t allowed,
+    uint64_t denied,
+    void* data);
+
+/// Calls func once for each interface the filter has been asked about, must be called from the display's thread
+/// display: a display wlbouncer was initialized for
+/// func: called with the interface name and how many times it was allowed and denied
+/// data: passed to func
+void wl_bouncer_for_each_interface_stats(
+    struct wl_display* display,
+    wl_bouncer_interface_stats_func_t func,
+    void* data);
 }
 
 #endif // WL_BOUNCER_H
@@ -0,0 +1,122 @@
+#include "audit_log.h"
+#include "file_writer.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+constexpr char binary_magic[8] = {'w', 'l', 'b', 'a', 'u', 'd', 'i', 't'};
+constexpr uint32_t binary_version = 1;
+
+template<typename T>
+void append(std::string& buffer, T value) {
+    buffer.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+
+auto now_ns() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void append_json_string(std::string& buffer, char const* str) {
+    buffer += '"';
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            buffer += '\\';
+        }
+        if (static_cast<unsigned char>(*str) >= 0x20) {
+            buffer += *str;
+        }
+    }
+    buffer += '"';
+}
+}
+
+struct AuditLog::Encoder {
+    using Source = AuditLog;
+
+    Format const format;
+
+    void drain(AuditLog& log, std::string& buffer);
+};
+
+auto AuditLog::open(std::string const& path, Format format, bool log_allowed) -> std::unique_ptr<AuditLog> {
+    auto writer = Writer::open(path, [&]() -> FILE* {
+        auto const file = fopen(path.c_str(), "ae");
+        if (!file) {
+            std::cerr << "wlbouncer: failed to open audit log " << path << ": " << strerror(errno) << std::endl;
+            return nullptr;
+        }
+        struct stat file_stat;
+        if (format == Format::binary && fstat(fileno(file), &file_stat) == 0 && file_stat.st_size == 0) {
+            fwrite(binary_magic, sizeof(binary_magic), 1, file);
+            fwrite(&binary_version, sizeof(binary_version), 1, file);
+            fflush(file);
+        }
+        return file;
+    }, Encoder{format});
+    if (!writer) {
+        return nullptr;
+    }
+    return std::unique_ptr<AuditLog>{new AuditLog{std::move(writer), log_allowed}};
+}
+
+AuditLog::AuditLog(std::shared_ptr<Writer> writer, bool log_allowed) :
+    writer{std::move(writer)},
+    log_allowed{log_allowed}
+{
+    this->writer->attach(this);
+}
+
+AuditLog::~AuditLog() {
+    writer->detach(this);
+}
+
+void AuditLog::record(AuditRecord const& record) {
+    if (!records.push(record)) {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+void AuditLog::Encoder::drain(AuditLog& log, std::string& buffer) {
+    AuditRecord record;
+    while (log.records.pop(&record)) {
+        auto const& name = *record.interface;
+        if (format == Format::json) {
+            buffer += "{\"time_ns\":" + std::to_string(record.time_ns)
+                + ",\"pid\":" + std::to_string(record.pid)
+                + ",\"uid\":" + std::to_string(record.uid)
+                + ",\"gid\":" + std::to_string(record.gid)
+                + ",\"interface\":";
+            append_json_string(buffer, name.c_str());
+            buffer += std::string{",\"allowed\":"} + (record.allowed ? "true" : "false")
+                + ",\"directive\":" + (record.directive < 0 ? "null" : std::to_string(record.directive))
+                + "}\n";
+        } else {
+            auto const name_length = static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX));
+            append<uint8_t>(buffer, 0);
+            append(buffer, record.time_ns);
+            append<int32_t>(buffer, record.pid);
+            append<uint32_t>(buffer, record.uid);
+            append<uint32_t>(buffer, record.gid);
+            append(buffer, record.directive);
+            append<uint8_t>(buffer, record.allowed);
+            append(buffer, name_length);
+            buffer.append(name.data(), name_length);
+        }
+    }
+    auto const total_dropped = log.dropped.load(std::memory_order_relaxed);
+    if (total_dropped != log.dropped_reported) {
+        auto const count = total_dropped - log.dropped_reported;
+        log.dropped_reported = total_dropped;
+        if (format == Format::json) {
+            buffer += "{\"time_ns\":" + std::to_string(now_ns()) + ",\"dropped\":" + std::to_string(count) + "}\n";
+        } else {
+            append<uint8_t>(buffer, 1);
+            append(buffer, now_ns());
+            append(buffer, count);
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef WL_BOUNCER_AUDIT_LOG_H
+#define WL_BOUNCER_AUDIT_LOG_H
+
+#include "ring_buffer.h"
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+template<typename Encoder>
+class FileWriter;
+
+/// One filter decision, fixed size so it can be queued without allocating
+struct AuditRecord {
+    /// Since the Unix epoch
+    int64_t time_ns;
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    /// Index of the directive that decided, or -1 if the defaults decided or the client could not be classified
+    int32_t directive;
+    /// Interned until the process exits, so the writer can read it after the interface struct is gone with the module
+    /// that defined it
+    std::string const* interface;
+    bool allowed;
+};
+
+/// Writes filter decisions to a file without blocking the display's thread. Records are queued in a ring buffer per
+/// display and written by a background thread, records that do not fit are counted and reported as dropped. Displays
+/// that open the same path share the file and the thread, in the format the first one opened it with.
+///
+/// The JSON lines format has one object per line, either a decision
+///   {"time_ns":...,"pid":...,"uid":...,"gid":...,"interface":"...","allowed":false,"directive":3}
+/// (directive is null when the defaults decided) or {"time_ns":...,"dropped":N}.
+///
+/// The binary format starts with the 8 bytes "wlbaudit" and a u32 version (1), followed by records in host byte
+/// order that start with a u8 kind. A decision (kind 0) continues with i64 time_ns, i32 pid, u32 uid, u32 gid,
+/// i32 directive, u8 allowed, u16 name length and the interface name. A drop notice (kind 1) continues with i64
+/// time_ns and u64 count.
+class AuditLog {
+public:
+    enum class Format {
+        json,
+        binary,
+    };
+
+    /// Returns null and prints why if the file can not be opened. Every display should open its own.
+    static auto open(std::string const& path, Format format, bool log_allowed) -> std::unique_ptr<AuditLog>;
+    /// Writes what is still queued
+    ~AuditLog();
+
+    /// If allowed decisions are logged as well as denied ones
+    auto logs_allowed() const -> bool { return log_allowed; }
+    /// Only called from the display's thread
+    void record(AuditRecord const& record);
+
+private:
+    /// Writes the records of every AuditLog sharing a file, in the format the file was opened with
+    struct Encoder;
+    using Writer = FileWriter<Encoder>;
+
+    AuditLog(std::shared_ptr<Writer> writer, bool log_allowed);
+    AuditLog(AuditLog const&) = delete;
+    auto operator=(AuditLog const&) = delete;
+
+    static constexpr size_t capacity = 4096;
+
+    std::shared_ptr<Writer> const writer;
+    bool const log_allowed;
+    RingBuffer<AuditRecord, capacity> records;
+    /// Written by the producer, read by the writer
+    std::atomic<uint64_t> dropped{0};
+    uint64_t dropped_reported = 0;
+};
+
+#endif // WL_BOUNCER_AUDIT_LOG_H
@@ -0,0 +1,77 @@
+#ifndef WL_BOUNCER_BITSET_H
+#define WL_BOUNCER_BITSET_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/// A dense, growable set of small integers
+class Bitset {
+public:
+    Bitset() = default;
+    explicit Bitset(size_t size) :
+        words((size + word_bits - 1) / word_bits, 0)
+    {}
+    explicit Bitset(std::vector<uint64_t> words) :
+        words{std::move(words)}
+    {}
+
+    auto test(size_t i) const -> bool {
+        auto const word = i / word_bits;
+        return word < words.size() && (words[word] >> (i % word_bits)) & 1;
+    }
+
+    /// Grows the set if needed
+    void set(size_t i, bool value = true) {
+        auto const word = i / word_bits;
+        if (word >= words.size()) {
+            if (!value) {
+                return;
+            }
+            words.resize(word + 1, 0);
+        }
+        auto const mask = uint64_t{1} << (i % word_bits);
+        words[word] = value ? words[word] | mask : words[word] & ~mask;
+    }
+
+    void clear() {
+        for (auto& word : words) {
+            word = 0;
+        }
+    }
+
+    auto is_subset_of(Bitset const& other) const -> bool {
+        for (size_t i = 0; i < words.size(); i++) {
+            auto const other_word = i < other.words.size() ? other.words[i] : 0;
+            if (words[i] & ~other_word) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// The highest index that is set in both a and b
+    static auto last_common(Bitset const& a, Bitset const& b) -> std::optional<size_t> {
+        for (auto word = std::min(a.words.size(), b.words.size()); word > 0; word--) {
+            auto const common = a.words[word - 1] & b.words[word - 1];
+            if (common) {
+                return (word - 1) * word_bits + std::bit_width(common) - 1;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /// The raw storage, bit i is bit i % 64 of word i / 64
+    auto data() const -> std::vector<uint64_t> const& { return words; }
+
+private:
+    static constexpr size_t word_bits = 64;
+
+    std::vector<uint64_t> words;
+};
+
+#endif // WL_BOUNCER_BITSET_H
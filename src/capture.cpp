@@ -0,0 +1,121 @@
+#include "capture.h"
+#include "file_writer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+template<typename T>
+void append(std::string& buffer, T value) {
+    buffer.append(reinterpret_cast<char const*>(&value), sizeof(value));
+}
+}
+
+struct Capture::Encoder {
+    using Source = Capture;
+
+    std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+    std::atomic<uint32_t> client_count{0};
+    /// The IDs interface records were written with
+    std::unordered_map<std::string const*, uint16_t> interfaces{};
+
+    auto now_ns() const -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void drain(Capture& capture, std::string& buffer);
+};
+
+auto Capture::open(std::string const& path) -> std::unique_ptr<Capture> {
+    auto writer = Writer::open(path, [&]() -> FILE* {
+        auto const file = fopen(path.c_str(), "we");
+        if (!file) {
+            std::cerr << "wlbouncer: failed to create capture " << path << ": " << strerror(errno) << std::endl;
+            return nullptr;
+        }
+        fwrite(magic, sizeof(magic), 1, file);
+        fwrite(&version, sizeof(version), 1, file);
+        fflush(file);
+        return file;
+    });
+    if (!writer) {
+        return nullptr;
+    }
+    return std::unique_ptr<Capture>{new Capture{std::move(writer)}};
+}
+
+Capture::Capture(std::shared_ptr<Writer> writer) :
+    writer{std::move(writer)}
+{
+    this->writer->attach(this);
+}
+
+Capture::~Capture() {
+    writer->detach(this);
+}
+
+auto Capture::next_client() -> uint32_t {
+    return writer->get_encoder().client_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Capture::record(CaptureEvent event) {
+    event.time_ns = writer->get_encoder().now_ns();
+    if (!events.push(event)) {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+void Capture::Encoder::drain(Capture& capture, std::string& buffer) {
+    CaptureEvent event;
+    while (capture.events.pop(&event)) {
+        switch (event.kind) {
+        case CaptureEvent::Kind::client_created:
+            append(buffer, static_cast<uint8_t>(event.kind));
+            append(buffer, event.time_ns);
+            append(buffer, event.client);
+            append<int32_t>(buffer, event.pid);
+            append<uint32_t>(buffer, event.uid);
+            append<uint32_t>(buffer, event.gid);
+            break;
+        case CaptureEvent::Kind::client_destroyed:
+            append(buffer, static_cast<uint8_t>(event.kind));
+            append(buffer, event.time_ns);
+            append(buffer, event.client);
+            break;
+        case CaptureEvent::Kind::filter: {
+            auto iter = interfaces.find(event.interface);
+            if (iter == interfaces.end()) {
+                auto const& name = *event.interface;
+                auto const name_length = static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX));
+                iter = interfaces.emplace(event.interface, static_cast<uint16_t>(interfaces.size())).first;
+                append(buffer, interface_record);
+                append(buffer, event.time_ns);
+                append(buffer, iter->second);
+                append(buffer, name_length);
+                buffer.append(name.data(), name_length);
+            }
+            append(buffer, static_cast<uint8_t>(event.kind));
+            append(buffer, event.time_ns);
+            append(buffer, event.client);
+            append(buffer, event.global);
+            append(buffer, iter->second);
+            append<uint8_t>(buffer,
+                (event.allowed ? allowed_flag : 0)
+                | (event.tracked ? tracked_flag : 0)
+                | (event.bypass == CaptureEvent::Bypass::unknown_client ? unknown_client_flag : 0)
+                | (event.bypass == CaptureEvent::Bypass::chained_filter ? chained_denied_flag : 0));
+            break;
+        }
+        }
+    }
+    auto const total_dropped = capture.dropped.load(std::memory_order_relaxed);
+    if (total_dropped != capture.dropped_reported) {
+        auto const count = total_dropped - capture.dropped_reported;
+        capture.dropped_reported = total_dropped;
+        append(buffer, dropped_record);
+        append(buffer, now_ns());
+        append(buffer, count);
+    }
+}
@@ -0,0 +1,106 @@
+#ifndef WL_BOUNCER_CAPTURE_H
+#define WL_BOUNCER_CAPTURE_H
+
+#include "ring_buffer.h"
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+template<typename Encoder>
+class FileWriter;
+
+/// One event of a display's filter workload, fixed size so it can be queued without allocating
+struct CaptureEvent {
+    enum class Kind : uint8_t {
+        client_created = 0,
+        client_destroyed = 1,
+        filter = 3,
+    };
+
+    /// Why wlbouncer's policy did not decide a filter call
+    enum class Bypass : uint8_t {
+        none,
+        unknown_client,
+        /// The compositor's own filter denied the global first
+        chained_filter,
+    };
+
+    Kind kind;
+    /// Since the capture started
+    uint64_t time_ns;
+    /// Numbered from 0 in the order clients connected
+    uint32_t client;
+    /// Only set for client_created
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    /// Only set for filter, the global's address identifies it for as long as it exists
+    uint64_t global;
+    /// Interned until the process exits, so the writer can read it after the interface struct is gone with the module
+    /// that defined it
+    std::string const* interface;
+    bool tracked;
+    bool allowed;
+    Bypass bypass;
+};
+
+/// Records which clients connect with which credentials and what the filter is asked about, for wlbouncer-replay to
+/// run the same workload offline. Events are queued in a ring buffer per display and written by a background thread,
+/// events that do not fit are counted and reported as dropped, which replay warns about. Displays that open the same
+/// path share the file and the thread, so their clients are numbered and timed together as one workload.
+///
+/// The file starts with the 8 bytes "wlbtrace" and a u32 version (2), followed by records in host byte order that
+/// start with a u8 kind and a u64 time_ns since the capture started:
+/// - 0 client created: u32 client, i32 pid, u32 uid, u32 gid
+/// - 1 client destroyed: u32 client
+/// - 2 interface: u16 interface, u16 name length and the name, written before the first filter record that uses it
+/// - 3 filter: u32 client (0xffffffff for clients wlbouncer did not know), u64 global, u16 interface, u8 flags
+///   (1 allowed, 2 tracked through wl_bouncer_global_created(), 4 from an unknown client, 8 denied by the compositor's
+///   own filter before the policy was consulted)
+///
+/// Version 1 is the same without flags 4 and 8, since calls that bypassed the policy were not recorded.
+/// - 4 dropped: u64 count
+class Capture {
+public:
+    static constexpr char magic[8] = {'w', 'l', 'b', 't', 'r', 'a', 'c', 'e'};
+    static constexpr uint32_t version = 2;
+    static constexpr uint8_t interface_record = 2;
+    static constexpr uint8_t dropped_record = 4;
+    static constexpr uint8_t allowed_flag = 1;
+    static constexpr uint8_t tracked_flag = 2;
+    static constexpr uint8_t unknown_client_flag = 4;
+    static constexpr uint8_t chained_denied_flag = 8;
+    /// The client ID of filter calls from clients wlbouncer did not know
+    static constexpr uint32_t unknown_client = UINT32_MAX;
+
+    /// Returns null and prints why if the file can not be created. Every display should open its own.
+    static auto open(std::string const& path) -> std::unique_ptr<Capture>;
+    /// Writes what is still queued
+    ~Capture();
+
+    /// Only called from the display's thread
+    void record(CaptureEvent event);
+    /// The ID of the next client to connect on any display sharing the file
+    auto next_client() -> uint32_t;
+
+private:
+    /// Writes the events of every Capture sharing a file, and numbers and times them together
+    struct Encoder;
+    using Writer = FileWriter<Encoder>;
+
+    Capture(std::shared_ptr<Writer> writer);
+    Capture(Capture const&) = delete;
+    auto operator=(Capture const&) = delete;
+
+    static constexpr size_t capacity = 16384;
+
+    std::shared_ptr<Writer> const writer;
+    RingBuffer<CaptureEvent, capacity> events;
+    /// Written by the producer, read by the writer
+    std::atomic<uint64_t> dropped{0};
+    uint64_t dropped_reported = 0;
+};
+
+#endif // WL_BOUNCER_CAPTURE_H
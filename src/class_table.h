@@ -0,0 +1,100 @@
+#ifndef WL_BOUNCER_CLASS_TABLE_H
+#define WL_BOUNCER_CLASS_TABLE_H
+
+#include "policy.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// The client classes of a display under one policy, stored column by column so an interface can be decided for all
+/// of them in one branch-free pass over contiguous words rather than a check() per client. T must have a size_t
+/// table_row member, which the table keeps up to date as rows move.
+template<typename T>
+class ClassTable {
+public:
+    explicit ClassTable(size_t directive_count) :
+        columns((directive_count + 63) / 64)
+    {}
+
+    void add(T* owner, Policy::Client const& client) {
+        owner->table_row = owners.size();
+        owners.push_back(owner);
+        auto const& words = Policy::matches(client).data();
+        for (size_t w = 0; w < columns.size(); w++) {
+            columns[w].push_back(w < words.size() ? words[w] : 0);
+        }
+        self.push_back(Policy::is_self(client));
+    }
+
+    /// Moves the last row into the removed one's place
+    void remove(T* owner) {
+        auto const row = owner->table_row;
+        auto const last = owners.size() - 1;
+        owners[row] = owners[last];
+        owners[row]->table_row = row;
+        owners.pop_back();
+        for (auto& column : columns) {
+            column[row] = column[last];
+            column.pop_back();
+        }
+        self[row] = self[last];
+        self.pop_back();
+    }
+
+    auto size() const -> size_t { return owners.size(); }
+
+    /// Calls f(owner, verdict) for every row, with the same Policy::Verdict that explain() would return
+    template<typename F>
+    void decide_all(Policy::Deciders const& deciders, F&& f) {
+        auto const count = owners.size();
+        decided.assign(count, 0);
+        allowed.assign(count, 0);
+        deciding.assign(count, 0);
+        // The highest directive decides, so words are scanned from the top and each row keeps the first hit
+        size_t undecided = count;
+        for (auto w = columns.size(); w-- > 0 && undecided;) {
+            auto const allowing = deciders.allowing[w];
+            auto const denying = deciders.denying[w];
+            if (!(allowing | denying)) {
+                continue;
+            }
+            auto const column = columns[w].data();
+            for (size_t row = 0; row < count; row++) {
+                auto const allow_hits = column[row] & allowing;
+                auto const deny_hits = column[row] & denying;
+                // The two sets are disjoint, so the larger one has the higher top bit
+                auto const hit = static_cast<uint8_t>(!decided[row] & ((allow_hits | deny_hits) != 0));
+                allowed[row] = hit ? allow_hits > deny_hits : allowed[row];
+                deciding[row] = hit ? w * 64 + 63 - std::countl_zero(allow_hits | deny_hits) : deciding[row];
+                decided[row] |= hit;
+                undecided -= hit;
+            }
+        }
+        for (size_t row = 0; row < count; row++) {
+            if (!decided[row]) {
+                allowed[row] = deciders.defaults_allow | self[row];
+            }
+        }
+        for (size_t row = 0; row < count; row++) {
+            f(owners[row], Policy::Verdict{
+                allowed[row] != 0,
+                decided[row] ? std::optional<size_t>{deciding[row]} : std::nullopt});
+        }
+    }
+
+private:
+    ClassTable(ClassTable const&) = delete;
+    auto operator=(ClassTable const&) = delete;
+
+    std::vector<T*> owners;
+    /// Word w of every row's Policy::matches()
+    std::vector<std::vector<uint64_t>> columns;
+    std::vector<uint8_t> self;
+    /// Scratch space for decide_all(), kept to avoid allocating on every pass
+    std::vector<uint8_t> decided;
+    std::vector<uint8_t> allowed;
+    std::vector<size_t> deciding;
+};
+
+#endif // WL_BOUNCER_CLASS_TABLE_H
@@ -0,0 +1,297 @@
+#include "compiled_policy.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+extern bool bouncer_debug;
+
+namespace {
+
+// Layout, all integers in host byte order:
+//   Header
+//   u32 name count, then for each name: u32 length, bytes
+//   u32 directive count, then for each directive:
+//     u8 enable, u8 fallthrough, extensions bitset
+//     u32 condition count, then for each condition: u8 field, u32 value count, then for each value: u32 length, bytes
+// where a bitset is a u32 word count followed by that many u64 words.
+
+constexpr char magic[8] = {'w', 'l', 'b', 'p', 'o', 'l', 'c', 'y'};
+/// Must be bumped whenever the layout or the meaning of a field changes
+constexpr uint32_t format_version = 4;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_checksum;
+    uint64_t payload_size;
+    uint64_t checksum;
+};
+
+/// FNV-1a, only meant to catch truncated, corrupted and replaced files
+auto checksum(char const* data, size_t size, uint64_t hash = 0xcbf29ce484222325) -> uint64_t {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001b3;
+    }
+    return hash;
+}
+
+class Writer {
+public:
+    template<typename T>
+    void put(T value) {
+        buffer.append(reinterpret_cast<char const*>(&value), sizeof(value));
+    }
+
+    void put_count(size_t count) {
+        if (count > UINT32_MAX) {
+            throw std::runtime_error{"policy too large"};
+        }
+        put(static_cast<uint32_t>(count));
+    }
+
+    void put_string(std::string_view value) {
+        put_count(value.size());
+        buffer.append(value);
+    }
+
+    void put_words(std::vector<uint64_t> const& words) {
+        put_count(words.size());
+        for (auto const word : words) {
+            put(word);
+        }
+    }
+
+    std::string buffer;
+};
+
+/// Reads the payload in place, throws if it runs past the end
+class Reader {
+public:
+    Reader(char const* data, size_t size) : pos{data}, end{data + size} {}
+
+    template<typename T>
+    auto get() -> T {
+        T value;
+        memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    auto get_string() -> std::string_view {
+        auto const size = get<uint32_t>();
+        return {take(size), size};
+    }
+
+    auto get_words() -> std::vector<uint64_t> {
+        std::vector<uint64_t> words(get<uint32_t>());
+        for (auto& word : words) {
+            word = get<uint64_t>();
+        }
+        return words;
+    }
+
+    auto at_end() const -> bool { return pos == end; }
+
+private:
+    auto take(size_t size) -> char const* {
+        if (static_cast<size_t>(end - pos) < size) {
+            throw std::runtime_error{"truncated"};
+        }
+        auto const result = pos;
+        pos += size;
+        return result;
+    }
+
+    char const* pos;
+    char const* end;
+};
+
+void parse_payload(Reader& reader, CompiledPolicy* policy) {
+    policy->names.resize(reader.get<uint32_t>());
+    for (auto& name : policy->names) {
+        name = reader.get_string();
+    }
+    policy->directives.resize(reader.get<uint32_t>());
+    for (auto& directive : policy->directives) {
+        directive.enable = reader.get<uint8_t>();
+        directive.fallthrough = reader.get<uint8_t>();
+        directive.extensions = reader.get_words();
+        directive.conditions.resize(reader.get<uint32_t>());
+        for (auto& condition : directive.conditions) {
+            condition.field = reader.get<uint8_t>();
+            condition.values.resize(reader.get<uint32_t>());
+            for (auto& value : condition.values) {
+                value = reader.get_string();
+            }
+        }
+    }
+    policy->rate_limits.resize(reader.get<uint32_t>());
+    for (auto& limit : policy->rate_limits) {
+        limit.scope = reader.get<uint8_t>();
+        limit.rate = reader.get<double>();
+        limit.burst = reader.get<double>();
+    }
+    if (!reader.at_end()) {
+        throw std::runtime_error{"trailing data"};
+    }
+}
+}
+
+auto source_checksum(std::string const& path) -> std::optional<uint64_t> {
+    auto const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    auto hash = checksum(nullptr, 0);
+    char buffer[65536];
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (length < 0 && errno == EINTR) {
+            continue;
+        } else if (length < 0) {
+            close(fd);
+            return std::nullopt;
+        }
+        hash = checksum(buffer, length, hash);
+    }
+    close(fd);
+    return hash;
+}
+
+void write_compiled_policy(CompiledPolicy const& policy, std::string const& path) {
+    Writer writer;
+    writer.put_count(policy.names.size());
+    for (auto const& name : policy.names) {
+        writer.put_string(name);
+    }
+    writer.put_count(policy.directives.size());
+    for (auto const& directive : policy.directives) {
+        writer.put<uint8_t>(directive.enable);
+        writer.put<uint8_t>(directive.fallthrough);
+        writer.put_words(directive.extensions);
+        writer.put_count(directive.conditions.size());
+        for (auto const& condition : directive.conditions) {
+            writer.put(condition.field);
+            writer.put_count(condition.values.size());
+            for (auto const& value : condition.values) {
+                writer.put_string(value);
+            }
+        }
+    }
+    writer.put_count(policy.rate_limits.size());
+    for (auto const& limit : policy.rate_limits) {
+        writer.put(limit.scope);
+        writer.put(limit.rate);
+        writer.put(limit.burst);
+    }
+
+    Header header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = format_version;
+    header.header_size = sizeof(Header);
+    header.source_size = policy.source_size;
+    header.source_mtime_ns = policy.source_mtime_ns;
+    header.source_checksum = policy.source_checksum;
+    header.payload_size = writer.buffer.size();
+    header.checksum = checksum(writer.buffer.data(), writer.buffer.size());
+
+    auto temp_path = path + ".XXXXXX";
+    auto const fd = mkstemp(temp_path.data());
+    if (fd < 0) {
+        throw std::runtime_error{"failed to create " + temp_path + ": " + strerror(errno)};
+    }
+    auto const write_all = [&](void const* data, size_t size) {
+        auto pos = static_cast<char const*>(data);
+        while (size > 0) {
+            auto const written = write(fd, pos, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            } else if (written < 0) {
+                return false;
+            }
+            pos += written;
+            size -= written;
+        }
+        return true;
+    };
+    // mkstemp() creates the file readable only by its owner, but compositors may run as other users
+    auto const ok =
+        fchmod(fd, 0644) == 0 &&
+        write_all(&header, sizeof(header)) &&
+        write_all(writer.buffer.data(), writer.buffer.size());
+    auto const error = errno;
+    close(fd);
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+        auto const message = strerror(ok ? errno : error);
+        unlink(temp_path.c_str());
+        throw std::runtime_error{"failed to write " + path + ": " + message};
+    }
+}
+
+auto read_compiled_policy(
+    std::string const& path,
+    std::shared_ptr<void const>* mapping_out
+) -> std::optional<CompiledPolicy> {
+    auto const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::nullopt;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(Header)) {
+        close(fd);
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: ignoring " << path << ": too small" << std::endl;
+        }
+        return std::nullopt;
+    }
+    size_t const size = file_stat.st_size;
+    auto const data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: failed to map " << path << ": " << strerror(errno) << std::endl;
+        }
+        return std::nullopt;
+    }
+    std::shared_ptr<void const> mapping{data, [size](void const* data) {
+        munmap(const_cast<void*>(data), size);
+    }};
+
+    auto const bytes = static_cast<char const*>(data);
+    Header header;
+    memcpy(&header, bytes, sizeof(header));
+    try {
+        if (memcmp(header.magic, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error{"not a compiled policy"};
+        }
+        if (header.version != format_version || header.header_size != sizeof(Header)) {
+            throw std::runtime_error{"compiled by a different version of wlbouncer"};
+        }
+        if (header.payload_size != size - sizeof(Header)) {
+            throw std::runtime_error{"truncated"};
+        }
+        auto const payload = bytes + sizeof(Header);
+        if (checksum(payload, header.payload_size) != header.checksum) {
+            throw std::runtime_error{"checksum mismatch"};
+        }
+        CompiledPolicy result;
+        result.source_size = header.source_size;
+        result.source_mtime_ns = header.source_mtime_ns;
+        result.source_checksum = header.source_checksum;
+        Reader reader{payload, header.payload_size};
+        parse_payload(reader, &result);
+        *mapping_out = std::move(mapping);
+        return result;
+    } catch (std::exception& e) {
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: ignoring " << path << ": " << e.what() << std::endl;
+        }
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef WL_BOUNCER_COMPILED_POLICY_H
+#define WL_BOUNCER_COMPILED_POLICY_H
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The contents of a compiled policy file, which holds a parsed config file so it can be loaded without YAML. Values
+/// keep their variables unresolved, since those depend on the process that loads the file.
+struct CompiledPolicy {
+    struct Condition {
+        uint8_t field;
+        std::vector<std::string_view> values;
+    };
+
+    struct Directive {
+        bool enable;
+        bool fallthrough;
+        std::vector<uint64_t> extensions;
+        std::vector<Condition> conditions;
+    };
+
+    struct RateLimit {
+        uint8_t scope;
+        double rate;
+        double burst;
+    };
+
+    /// The size, modification time and source_checksum() of the config file this was compiled from. Copying tools
+    /// keep the size and modification time, so only the checksum tells a replaced file apart.
+    uint64_t source_size = 0;
+    int64_t source_mtime_ns = 0;
+    uint64_t source_checksum = 0;
+    /// Interface names in ID order, starting with the built-in defaults
+    std::vector<std::string_view> names;
+    std::vector<Directive> directives;
+    std::vector<RateLimit> rate_limits;
+};
+
+/// A checksum of the file's contents, nullopt if it can not be read
+auto source_checksum(std::string const& path) -> std::optional<uint64_t>;
+
+/// Writes to a temporary file and renames it over path, so readers never see a partial file. Throws on failure.
+void write_compiled_policy(CompiledPolicy const& policy, std::string const& path);
+
+/// Maps path read-only. The string views in the result point into the mapping, which mapping_out keeps alive. Returns
+/// nullopt if the file does not exist or is not a valid compiled policy of the current version.
+auto read_compiled_policy(
+    std::string const& path,
+    std::shared_ptr<void const>* mapping_out) -> std::optional<CompiledPolicy>;
+
+#endif // WL_BOUNCER_COMPILED_POLICY_H
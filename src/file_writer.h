@@ -0,0 +1,118 @@
+#ifndef WL_BOUNCER_FILE_WRITER_H
+#define WL_BOUNCER_FILE_WRITER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// A file written by a background thread, shared by every source in the process that opens the same path. Sources
+/// queue records without locking (each one is typically a display with its own ring buffer), and the thread drains
+/// all of them every flush_interval. Encoder has a Source type and a drain(Source&, std::string&) member that pops
+/// everything the source has queued and appends it to the buffer. It is only called with the writer's lock held, so
+/// it may keep state shared by all sources.
+template<typename Encoder>
+class FileWriter {
+public:
+    using Source = typename Encoder::Source;
+
+    /// How long records can wait in a source before being written
+    static constexpr auto flush_interval = std::chrono::milliseconds{100};
+
+    /// Returns the writer already open on path, otherwise calls open_file(), which returns the opened file or null
+    /// after printing why, and starts one with an Encoder made from encoder_args. Opening a path only once also keeps a
+    /// second source from truncating what the first one wrote.
+    template<typename OpenFile, typename... Args>
+    static auto open(std::string const& path, OpenFile&& open_file, Args&&... encoder_args)
+        -> std::shared_ptr<FileWriter>
+    {
+        static std::mutex writers_mutex;
+        static std::unordered_map<std::string, std::weak_ptr<FileWriter>> writers;
+        std::lock_guard lock{writers_mutex};
+        auto writer = writers[path].lock();
+        if (!writer) {
+            auto const file = open_file();
+            if (!file) {
+                return nullptr;
+            }
+            writer = std::make_shared<FileWriter>(file, std::forward<Args>(encoder_args)...);
+            writers[path] = writer;
+        }
+        return writer;
+    }
+
+    template<typename... Args>
+    explicit FileWriter(FILE* file, Args&&... encoder_args) :
+        file{file},
+        encoder{std::forward<Args>(encoder_args)...},
+        thread{[this]() { run(); }}
+    {}
+
+    ~FileWriter() {
+        {
+            std::lock_guard lock{mutex};
+            stop = true;
+        }
+        stop_cv.notify_one();
+        thread.join();
+        fclose(file);
+    }
+
+    /// Members of the encoder that sources read must be safe to read from any thread
+    auto get_encoder() -> Encoder& { return encoder; }
+
+    void attach(Source* source) {
+        std::lock_guard lock{mutex};
+        sources.push_back(source);
+    }
+
+    /// Writes what the source still has queued, it is not drained again after this returns
+    void detach(Source* source) {
+        std::lock_guard lock{mutex};
+        std::string buffer;
+        encoder.drain(*source, buffer);
+        write(buffer);
+        sources.erase(std::find(sources.begin(), sources.end(), source));
+    }
+
+private:
+    FileWriter(FileWriter const&) = delete;
+    auto operator=(FileWriter const&) = delete;
+
+    FILE* const file;
+    /// Guards everything below, and is only taken by the writer thread and by sources attaching and detaching
+    std::mutex mutex;
+    Encoder encoder;
+    std::vector<Source*> sources;
+    std::condition_variable stop_cv;
+    bool stop = false;
+    std::thread thread;
+
+    void run() {
+        std::unique_lock lock{mutex};
+        while (!stop) {
+            stop_cv.wait_for(lock, flush_interval);
+            std::string buffer;
+            for (auto const source : sources) {
+                encoder.drain(*source, buffer);
+            }
+            write(buffer);
+        }
+    }
+
+    void write(std::string const& buffer) {
+        if (!buffer.empty()) {
+            fwrite(buffer.data(), buffer.size(), 1, file);
+            fflush(file);
+        }
+    }
+};
+
+#endif // WL_BOUNCER_FILE_WRITER_H
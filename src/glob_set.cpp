@@ -0,0 +1,100 @@
+#include "glob_set.h"
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+auto GlobSet::is_pattern(std::string_view name) -> bool {
+    return name.find_first_of("*?") != std::string_view::npos;
+}
+
+GlobSet::GlobSet(std::vector<std::string_view> const& patterns) {
+    // NFA state offsets[p] + k means the first k characters of pattern p have matched
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> state_pattern;
+    for (uint32_t p = 0; p < patterns.size(); p++) {
+        offsets.push_back(state_pattern.size());
+        state_pattern.insert(state_pattern.end(), patterns[p].size() + 1, p);
+        for (auto const c : patterns[p]) {
+            auto& cls = char_class[static_cast<uint8_t>(c)];
+            if (c != '*' && c != '?' && !cls) {
+                if (class_count > UINT8_MAX) {
+                    throw std::runtime_error{"interface patterns use too many different characters"};
+                }
+                cls = class_count++;
+            }
+        }
+    }
+    auto const pattern_char = [&](uint32_t state) -> int {
+        auto const& pattern = patterns[state_pattern[state]];
+        auto const pos = state - offsets[state_pattern[state]];
+        return pos < pattern.size() ? pattern[pos] : -1;
+    };
+    // A * may also match nothing, so a state before one implies the state after it
+    auto const closure = [&](std::vector<uint32_t>& states) {
+        for (size_t i = 0; i < states.size(); i++) {
+            if (pattern_char(states[i]) == '*') {
+                states.push_back(states[i] + 1);
+            }
+        }
+        std::sort(states.begin(), states.end());
+        states.erase(std::unique(states.begin(), states.end()), states.end());
+    };
+
+    std::vector<std::vector<uint32_t>> dfa_states{{}, {offsets.begin(), offsets.end()}};
+    closure(dfa_states[start_state]);
+    std::map<std::vector<uint32_t>, uint32_t> state_ids{{dfa_states[0], dead_state}, {dfa_states[1], start_state}};
+    std::map<std::vector<uint32_t>, int32_t> set_ids;
+    for (uint32_t state = 0; state < dfa_states.size(); state++) {
+        for (size_t cls = 0; cls < class_count; cls++) {
+            std::vector<uint32_t> next;
+            for (auto const nfa_state : dfa_states[state]) {
+                auto const c = pattern_char(nfa_state);
+                if (c == '*') {
+                    next.push_back(nfa_state);
+                } else if (c == '?' || (c >= 0 && cls && char_class[static_cast<uint8_t>(c)] == cls)) {
+                    next.push_back(nfa_state + 1);
+                }
+            }
+            closure(next);
+            auto const [iter, inserted] = state_ids.emplace(next, dfa_states.size());
+            if (inserted) {
+                if (dfa_states.size() >= max_states) {
+                    throw std::runtime_error{"interface patterns need more than " + std::to_string(max_states) +
+                        " states to match, use fewer or more specific wildcards"};
+                }
+                dfa_states.push_back(std::move(next));
+            }
+            transitions.push_back(iter->second);
+        }
+        std::vector<uint32_t> matched;
+        for (auto const nfa_state : dfa_states[state]) {
+            if (pattern_char(nfa_state) < 0) {
+                matched.push_back(state_pattern[nfa_state]);
+            }
+        }
+        if (matched.empty()) {
+            accepting.push_back(no_match);
+        } else {
+            auto const [iter, inserted] = set_ids.emplace(matched, sets.size());
+            if (inserted) {
+                sets.push_back(std::move(matched));
+            }
+            accepting.push_back(iter->second);
+        }
+    }
+}
+
+auto GlobSet::match(std::string_view name) const -> int32_t {
+    if (transitions.empty()) {
+        return no_match;
+    }
+    auto state = start_state;
+    for (auto const c : name) {
+        state = transitions[state * class_count + char_class[static_cast<uint8_t>(c)]];
+        if (state == dead_state) {
+            return no_match;
+        }
+    }
+    return accepting[state];
+}
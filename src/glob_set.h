@@ -0,0 +1,47 @@
+#ifndef WL_BOUNCER_GLOB_SET_H
+#define WL_BOUNCER_GLOB_SET_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/// Matches a name against many glob patterns at once, where * matches any run of characters and ? matches any single
+/// character. The patterns are compiled into one DFA, so matching costs one table lookup per character of the name
+/// however many patterns there are.
+class GlobSet {
+public:
+    static constexpr int32_t no_match = -1;
+
+    /// If name contains a wildcard, and so is a pattern rather than an interface name
+    static auto is_pattern(std::string_view name) -> bool;
+
+    /// Matches nothing
+    GlobSet() = default;
+    /// Throws if the patterns need an unreasonable number of DFA states
+    explicit GlobSet(std::vector<std::string_view> const& patterns);
+
+    /// Returns the index into match_sets() of the patterns that match name, or no_match if none do
+    auto match(std::string_view name) const -> int32_t;
+    /// Each distinct set of patterns that some name matches, as sorted indexes into the constructor's patterns
+    auto match_sets() const -> std::vector<std::vector<uint32_t>> const& { return sets; }
+    auto state_count() const -> size_t { return accepting.size(); }
+
+private:
+    static constexpr size_t max_states = 4096;
+    /// State 0 matches nothing whatever follows, so matching stops early when it is reached
+    static constexpr uint32_t dead_state = 0;
+    static constexpr uint32_t start_state = 1;
+
+    /// Characters that no pattern mentions by name share class 0
+    std::array<uint8_t, 256> char_class{};
+    size_t class_count = 1;
+    /// Indexed by state * class_count + character class
+    std::vector<uint32_t> transitions;
+    /// Indexed by state, an index into sets or no_match
+    std::vector<int32_t> accepting;
+    std::vector<std::vector<uint32_t>> sets;
+};
+
+#endif // WL_BOUNCER_GLOB_SET_H
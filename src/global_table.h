@@ -0,0 +1,113 @@
+#ifndef WL_BOUNCER_GLOBAL_TABLE_H
+#define WL_BOUNCER_GLOBAL_TABLE_H
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+struct wl_global;
+
+/// Maps the globals wlbouncer has seen created to a value. Uses open addressing with linear probing because there
+/// are only ever a few hundred globals and lookups happen on every filter call.
+template<typename T>
+class GlobalTable {
+public:
+    GlobalTable() :
+        slots(16)
+    {}
+
+    auto find(wl_global const* global) const -> std::optional<T> {
+        for (auto i = home(global);; i = (i + 1) & mask()) {
+            auto const& slot = slots[i];
+            if (slot.global == global) {
+                return slot.value;
+            } else if (!slot.global && !slot.tombstone) {
+                return std::nullopt;
+            }
+        }
+    }
+
+    void insert(wl_global const* global, T value) {
+        if ((count + tombstones + 1) * 4 > slots.size() * 3) {
+            rehash(count * 2 > slots.size() / 2 ? slots.size() * 2 : slots.size());
+        }
+        std::optional<size_t> reusable;
+        for (auto i = home(global);; i = (i + 1) & mask()) {
+            auto& slot = slots[i];
+            if (slot.global == global) {
+                slot.value = value;
+                return;
+            } else if (slot.tombstone) {
+                if (!reusable) {
+                    reusable = i;
+                }
+            } else if (!slot.global) {
+                auto& target = slots[reusable.value_or(i)];
+                if (target.tombstone) {
+                    tombstones--;
+                }
+                target = Slot{global, value, false};
+                count++;
+                return;
+            }
+        }
+    }
+
+    void erase(wl_global const* global) {
+        for (auto i = home(global);; i = (i + 1) & mask()) {
+            auto& slot = slots[i];
+            if (slot.global == global) {
+                slot = Slot{nullptr, {}, true};
+                count--;
+                tombstones++;
+                return;
+            } else if (!slot.global && !slot.tombstone) {
+                return;
+            }
+        }
+    }
+
+    /// Calls f(global, value) for each global
+    template<typename F>
+    void for_each(F&& f) const {
+        for (auto const& slot : slots) {
+            if (slot.global) {
+                f(slot.global, slot.value);
+            }
+        }
+    }
+
+    auto size() const -> size_t { return count; }
+
+private:
+    struct Slot {
+        wl_global const* global;
+        T value;
+        bool tombstone;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+    size_t tombstones = 0;
+
+    auto mask() const -> size_t { return slots.size() - 1; }
+
+    auto home(wl_global const* global) const -> size_t {
+        // Allocations are aligned, so the low bits carry no information
+        return (reinterpret_cast<uintptr_t>(global) >> 4) * 0x9e3779b97f4a7c15ull >> 32 & mask();
+    }
+
+    void rehash(size_t capacity) {
+        auto const old = std::move(slots);
+        slots = std::vector<Slot>(capacity);
+        count = 0;
+        tombstones = 0;
+        for (auto const& slot : old) {
+            if (slot.global) {
+                insert(slot.global, slot.value);
+            }
+        }
+    }
+};
+
+#endif // WL_BOUNCER_GLOBAL_TABLE_H
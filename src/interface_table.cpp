@@ -0,0 +1,67 @@
+#include "interface_table.h"
+#include "known_interfaces.h"
+
+auto InterfaceTable::intern(std::string_view name) -> InterfaceId {
+    auto const known = known_interfaces::find(name);
+    if (known != known_interfaces::not_known) {
+        return intern_known(known);
+    }
+    auto const iter = ids.find(name);
+    if (iter != ids.end()) {
+        return iter->second;
+    }
+    return intern_external(owned.emplace_back(name));
+}
+
+auto InterfaceTable::intern_known(int32_t known) -> InterfaceId {
+    if (known_ids.empty()) {
+        known_ids.assign(known_interfaces::names.size(), no_id);
+    }
+    auto& id = known_ids[known];
+    if (id == no_id) {
+        id = static_cast<InterfaceId>(names.size());
+        // Known names are static, so they never need to be copied
+        names.push_back(known_interfaces::names[known]);
+    }
+    return id;
+}
+
+auto InterfaceTable::intern_external(std::string_view name) -> InterfaceId {
+    auto const known = known_interfaces::find(name);
+    if (known != known_interfaces::not_known) {
+        return intern_known(known);
+    }
+    auto const [iter, inserted] = ids.emplace(name, static_cast<InterfaceId>(names.size()));
+    if (inserted) {
+        names.push_back(name);
+    }
+    return iter->second;
+}
+
+auto InterfaceTable::find(std::string_view name) const -> InterfaceId {
+    auto const known = known_interfaces::find(name);
+    if (known != known_interfaces::not_known) {
+        return known_ids.empty() || known_ids[known] == no_id ? unknown() : known_ids[known];
+    }
+    auto const iter = ids.find(name);
+    return iter == ids.end() ? unknown() : iter->second;
+}
+
+auto InterfaceTable::name(InterfaceId id) const -> std::string_view {
+    return id < names.size() ? names[id] : std::string_view{};
+}
+
+void InterfaceTable::clear() {
+    ids.clear();
+    known_ids.clear();
+    names.clear();
+    owned.clear();
+}
+
+auto InterfaceTable::known_names() -> std::span<std::string_view const> {
+    return known_interfaces::names;
+}
+
+auto InterfaceTable::is_known(std::string_view name) -> bool {
+    return known_interfaces::find(name) != known_interfaces::not_known;
+}
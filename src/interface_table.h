@@ -0,0 +1,56 @@
+#ifndef WL_BOUNCER_INTERFACE_TABLE_H
+#define WL_BOUNCER_INTERFACE_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using InterfaceId = uint32_t;
+
+/// Maps each interface name a policy knows about to a small integer ID. All names that are not in the table share
+/// the unknown() ID, since no directive can tell them apart. Names from the protocols known at build time (see
+/// known_interfaces.h) are found through a perfect hash, other names through a hash map.
+class InterfaceTable {
+public:
+    /// Returns the ID of name, adding it to the table if needed
+    auto intern(std::string_view name) -> InterfaceId;
+    /// Returns the ID of the known interface with the given index, adding it to the table if needed
+    auto intern_known(int32_t known) -> InterfaceId;
+    /// Like intern(), but does not copy name, which must outlive the table
+    auto intern_external(std::string_view name) -> InterfaceId;
+    /// Returns the ID of name or unknown() if it is not in the table, does not allocate
+    auto find(std::string_view name) const -> InterfaceId;
+    auto name(InterfaceId id) const -> std::string_view;
+    auto unknown() const -> InterfaceId { return names.size(); }
+    /// The number of IDs, including unknown()
+    auto size() const -> size_t { return names.size() + 1; }
+    void clear();
+
+    /// Every interface in the protocols known at build time, empty if none were found
+    static auto known_names() -> std::span<std::string_view const>;
+    static auto is_known(std::string_view name) -> bool;
+
+private:
+    static constexpr InterfaceId no_id = UINT32_MAX;
+
+    struct Hash {
+        using is_transparent = void;
+        auto operator()(std::string_view name) const -> size_t {
+            return std::hash<std::string_view>{}(name);
+        }
+    };
+
+    /// IDs of names that are not known interfaces
+    std::unordered_map<std::string_view, InterfaceId, Hash> ids;
+    /// IDs of known interfaces by their index, no_id for those not in the table
+    std::vector<InterfaceId> known_ids;
+    std::vector<std::string_view> names;
+    /// Storage for names added with intern(), a deque so growing it does not move the strings
+    std::deque<std::string> owned;
+};
+
+#endif // WL_BOUNCER_INTERFACE_TABLE_H
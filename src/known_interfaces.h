@@ -0,0 +1,45 @@
+#ifndef WL_BOUNCER_KNOWN_INTERFACES_H
+#define WL_BOUNCER_KNOWN_INTERFACES_H
+
+#include "known_interfaces_table.h"
+#include <cstdint>
+#include <string_view>
+
+/// Interfaces from the wayland and wayland-protocols XML installed at build time, looked up through a perfect hash
+/// generated by tools/gen_known_interfaces.py: one pass over the name and one string compare. Indexes are stable for
+/// a build, so they can be resolved at compile time.
+namespace known_interfaces {
+
+inline constexpr int32_t not_known = -1;
+
+/// FNV-1a, must match fnv1a() in tools/gen_known_interfaces.py
+constexpr auto hash(std::string_view name) -> uint64_t {
+    uint64_t h = 0xcbf29ce484222325;
+    for (auto const c : name) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+    }
+    return h;
+}
+
+/// Mixes the low half of the hash with the displacement of its bucket, must match slot() in
+/// tools/gen_known_interfaces.py
+constexpr auto slot(uint64_t h, uint32_t displacement) -> size_t {
+    auto x = static_cast<uint32_t>(h) ^ (displacement * 0x9e3779b9u);
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x & (slots.size() - 1);
+}
+
+/// Returns the index of name in names, or not_known
+constexpr auto find(std::string_view name) -> int32_t {
+    auto const h = hash(name);
+    auto const entry = slots[slot(h, displacements[(h >> 32) % displacements.size()])];
+    return entry && names[entry - 1] == name ? entry - 1 : not_known;
+}
+
+}
+
+#endif // WL_BOUNCER_KNOWN_INTERFACES_H
@@ -1,9 +1,18 @@
+#include <cstring>
 #include <iostream>
 #include <dlfcn.h>
 #include "wlbouncer.h"
 #include <wayland-server-core.h>
 
 wl_display* (*real_wl_display_create)(void) = nullptr;
+wl_global* (*real_wl_global_create)(
+    wl_display* display,
+    wl_interface const* interface,
+    int version,
+    void* data,
+    wl_global_bind_func_t bind
+) = nullptr;
+void (*real_wl_global_destroy)(wl_global* global) = nullptr;
 extern void (*real_wl_display_set_global_filter)(
     wl_display *display,
     wl_display_global_filter_func_t filter,
@@ -17,6 +26,8 @@ void set_wrapped_display_filter(
 );
 
 bool const keep_ld_preload = getenv("BOUNCER_KEEP_LD_PRELOAD");
+char const* const async_init = getenv("BOUNCER_ASYNC_INIT");
+bool const pure_filter = getenv("BOUNCER_PURE_FILTER");
 
 static void libwayland_shim_init()
 {
@@ -34,6 +45,8 @@ static void libwayland_shim_init()
 
     INIT_SYM(wl_display_create);
     INIT_SYM(wl_display_set_global_filter);
+    INIT_SYM(wl_global_create);
+    INIT_SYM(wl_global_destroy);
 
 #undef INIT_SYM
 
@@ -49,7 +62,14 @@ struct wl_display* wl_display_create() {
     }
     libwayland_shim_init();
     struct wl_display* const display = real_wl_display_create();
-    wl_bouncer_init_for_display(display, nullptr, nullptr, nullptr);
+    uint32_t flags = 0;
+    if (async_init) {
+        flags |= WL_BOUNCER_INIT_ASYNC | (strcmp(async_init, "closed") == 0 ? WL_BOUNCER_INIT_FAIL_CLOSED : 0);
+    }
+    if (pure_filter) {
+        flags |= WL_BOUNCER_INIT_FILTER_PURE;
+    }
+    wl_bouncer_init_for_display_with_flags(display, nullptr, nullptr, nullptr, flags);
     return display;
 }
 
@@ -61,4 +81,25 @@ void wl_display_set_global_filter(
     set_wrapped_display_filter(display, filter, data);
 }
 
+struct wl_global* wl_global_create(
+    struct wl_display* display,
+    struct wl_interface const* interface,
+    int version,
+    void* data,
+    wl_global_bind_func_t bind
+) {
+    libwayland_shim_init();
+    struct wl_global* const global = real_wl_global_create(display, interface, version, data, bind);
+    if (global) {
+        wl_bouncer_global_created(global);
+    }
+    return global;
+}
+
+void wl_global_destroy(struct wl_global* global) {
+    libwayland_shim_init();
+    wl_bouncer_global_destroyed(global);
+    real_wl_global_destroy(global);
+}
+
 }
@@ -1,10 +1,33 @@
 #include "wlbouncer.h"
 #include "policy.h"
+#include "class_table.h"
+#include "global_table.h"
+#include "policy_loader.h"
+#include "policy_watcher.h"
+#include "rate_limiter.h"
+#include "policy_cache.h"
+#include "name_resolver.h"
+#include "stats.h"
+#include "slab.h"
+#include "audit_log.h"
+#include "capture.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <unordered_map>
 #include <string>
+#include <cstring>
 #include <iostream>
-#include <mutex>
+#include <utility>
+#include <vector>
 #include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <sys/eventfd.h>
+#include <csignal>
 
 void (*real_wl_display_set_global_filter)(
     wl_display *display,
@@ -14,22 +37,277 @@ void (*real_wl_display_set_global_filter)(
 
 bool bouncer_debug = getenv("BOUNCER_DEBUG");
 
+/// A handle from wl_bouncer_resolve_interface(), kept until the process exits
+struct wl_bouncer_interface {
+    std::string const name;
+    /// Numbered from 0 in the order names were first resolved, indexes DisplayCtx::queried
+    uint32_t const index;
+};
+
 namespace {
 
-struct ClientCtx;
+struct DisplayCtx;
 
-struct DisplayCtx {
-    DisplayCtx(const char* config_file) :
-        policy{config_file}
+/// Decisions shared by all clients with the same Policy::ClassKey
+struct ClientClass {
+    std::shared_ptr<Policy::Client const> const policy_client;
+    /// Indexed by InterfaceId, allowed is only meaningful where known is set
+    Bitset known;
+    Bitset allowed;
+    /// The table of the policy the class was created for, which it stays in for its whole life
+    ClassTable<ClientClass>& table;
+    size_t table_row;
+
+    ClientClass(
+        std::shared_ptr<Policy::Client const> policy_client,
+        size_t interface_count,
+        ClassTable<ClientClass>& table
+    ) :
+        policy_client{std::move(policy_client)},
+        known{interface_count},
+        allowed{interface_count},
+        table{table}
+    {
+        table.add(this, *this->policy_client);
+    }
+
+    ~ClientClass() {
+        table.remove(this);
+    }
+
+    ClientClass(ClientClass const&) = delete;
+    auto operator=(ClientClass const&) = delete;
+
+    auto decide(Policy const& policy, InterfaceId id) -> bool {
+        if (!known.test(id)) {
+            known.set(id);
+            allowed.set(id, policy.check(*policy_client, id));
+        }
+        return allowed.test(id);
+    }
+};
+
+using ClassMap = std::unordered_map<Policy::ClassKey, std::shared_ptr<ClientClass>, Policy::ClassKey::Hash>;
+
+/// What a display knows about one wl_interface. Interface structs are static, so resolving each one once avoids
+/// hashing names on every filter call.
+struct InterfaceRecord {
+    wl_interface const* const interface;
+    /// Interned until the process exits, for writer threads that may read it after the module that defined the
+    /// interface struct was unloaded
+    std::string const& name;
+    /// The ID in the display's current policy
+    InterfaceId id;
+    /// Set once every class has a decision on this interface, later classes decide for themselves
+    bool decided_for_all = false;
+    std::atomic<uint64_t> allowed{0};
+    std::atomic<uint64_t> denied{0};
+
+    InterfaceRecord(wl_interface const* interface, InterfaceId id) :
+        interface{interface},
+        name{wl_bouncer_resolve_interface(interface->name)->name},
+        id{id}
     {}
+};
+
+/// What a display resolved a wl_bouncer_interface to under its current policy
+struct QueriedInterface {
+    /// Null until the handle is first queried on the display
+    wl_bouncer_interface const* handle = nullptr;
+    InterfaceId id = 0;
+};
+
+/// A global reported by wl_bouncer_global_created()
+struct TrackedGlobal {
+    InterfaceRecord* record;
+    /// Small and reused once the global is destroyed, indexes ClientCtx::filter_known and filter_allowed
+    uint32_t index;
+};
+
+/// Everything wlbouncer keeps for a client, in a single slab record
+struct alignas(64) ClientCtx {
+    ClientCtx(DisplayCtx* display_ctx, wl_client* client) :
+        display_ctx{display_ctx},
+        client{client}
+    {}
+
+    /// Null if the client's credentials could not be resolved
+    std::shared_ptr<ClientClass> client_class;
+    DisplayCtx* const display_ctx;
+    wl_client* const client;
+    /// Set while waiting on the NameResolver, the client sees no globals until its names are known
+    bool names_pending = false;
+    /// Set if the client connected over the rate limit, it has no class and is destroyed when the loop is next idle
+    wl_event_source* reject_source = nullptr;
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    /// The client's number in the capture, if one is being written
+    uint32_t capture_id = 0;
+    /// What a pure wrapped filter returned for this client, indexed by TrackedGlobal::index. allowed is only
+    /// meaningful where known is set.
+    Bitset filter_known;
+    Bitset filter_allowed;
+    /// Also finds the ClientCtx of a wl_client, see find_client_ctx()
+    wl_listener destroy_listener;
+    /// In DisplayCtx::clients
+    wl_list link;
+};
+
+static_assert(
+    std::is_standard_layout<ClientCtx>::value,
+    "ClientCtx must be standard layout due to wl_container_of requirements");
+
+struct DisplayCtx {
+    DisplayCtx(std::shared_ptr<Policy const> policy) :
+        policy{std::move(policy)},
+        class_table{std::make_unique<ClassTable<ClientClass>>(this->policy->directive_count())},
+        names_fd{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+    {
+        wl_list_init(&clients);
+        NameResolver::get().add_listener(names_fd);
+        if (!this->policy->path().empty()) {
+            bump(stats.policy_loads);
+            stats.policy_load_ns.store(this->policy->load_duration().count(), std::memory_order_relaxed);
+        }
+        update_rate_limiters();
+    }
+
+    ~DisplayCtx() {
+        NameResolver::get().remove_listener(names_fd);
+        if (names_source) {
+            wl_event_source_remove(names_source);
+        }
+        if (stats_signal_source) {
+            wl_event_source_remove(stats_signal_source);
+        }
+        close(names_fd);
+    }
 
-    Policy policy;
+    /// Only replaced from the event loop, so the filter can use it without locking
+    std::shared_ptr<Policy const> policy;
+    std::unique_ptr<PolicyWatcher> watcher;
+    /// Set while the policy is loaded in the background, in which case policy is a placeholder until it finishes
+    std::unique_ptr<PolicyLoader> loader;
     wl_display_global_filter_func_t wrapped_filter = nullptr;
     void* wrapped_filter_data = nullptr;
-    std::unordered_map<wl_client const*, ClientCtx*> clients;
+    /// If the compositor declared that wrapped_filter depends only on the client and global, in which case its
+    /// results for tracked globals are kept until wl_bouncer_invalidate()
+    bool wrapped_filter_pure = false;
+    /// ClientCtx::link of every client
+    wl_list clients;
+    Slab<ClientCtx> client_slab;
+    /// Every class of the current policy, shared or not. Declared before classes so it outlives them.
+    std::unique_ptr<ClassTable<ClientClass>> class_table;
+    ClassMap classes;
+    std::unordered_map<wl_interface const*, InterfaceRecord> interfaces;
+    /// Globals reported by wl_bouncer_global_created(), which skip the interface lookup entirely
+    GlobalTable<TrackedGlobal> globals;
+    /// TrackedGlobal::index values of destroyed globals, ready for reuse
+    std::vector<uint32_t> free_global_indexes;
+    uint32_t global_index_count = 0;
+    /// Indexed by wl_bouncer_interface::index, re-resolved whenever the policy is replaced
+    std::vector<QueriedInterface> queried;
+    /// Readable when the NameResolver finishes a lookup
+    int const names_fd;
+    wl_event_source* names_source = nullptr;
+    Stats stats;
+    wl_event_source* stats_signal_source = nullptr;
+    /// Indexed by Policy::RateScope, null for scopes the policy does not limit
+    std::array<std::unique_ptr<RateLimiter>, Policy::rate_scopes> rate_limiters;
+    /// Null unless BOUNCER_AUDIT is set
+    std::unique_ptr<AuditLog> audit;
+    /// Null unless BOUNCER_CAPTURE is set
+    std::unique_ptr<Capture> capture;
 
-    static std::mutex display_map_mutex;
-    static std::unordered_map<wl_display*, DisplayCtx*> display_map;
+    auto interface_record(wl_interface const* interface) -> InterfaceRecord* {
+        auto iter = interfaces.find(interface);
+        if (iter == interfaces.end()) {
+            auto const id = policy->find_interface(interface->name);
+            iter = interfaces.emplace(
+                std::piecewise_construct,
+                std::forward_as_tuple(interface),
+                std::forward_as_tuple(interface, id)).first;
+        }
+        return &iter->second;
+    }
+
+    /// Clients whose names are still being resolved see no globals, and are only told about them once the names are
+    /// known through the globals the compositor reports. Without any the names are resolved on the display's thread.
+    auto resolves_names_async() const -> bool {
+        return globals.size() > 0;
+    }
+
+    /// Runs wrapped_filter, or returns what it returned before if it is pure and the global is tracked
+    auto wrapped_filter_allows(
+        ClientCtx* client_ctx,
+        wl_global const* global,
+        std::optional<TrackedGlobal> const& tracked
+    ) -> bool {
+        auto const memoize = wrapped_filter_pure && tracked;
+        if (memoize && client_ctx->filter_known.test(tracked->index)) {
+            return client_ctx->filter_allowed.test(tracked->index);
+        }
+        bump(stats.chained_filter_calls);
+        auto const allowed = wrapped_filter(client_ctx->client, global, wrapped_filter_data);
+        if (memoize) {
+            client_ctx->filter_known.set(tracked->index);
+            client_ctx->filter_allowed.set(tracked->index, allowed);
+        }
+        return allowed;
+    }
+
+    /// Decides the interface for every class in one pass over the class table, so when a global appears each client
+    /// hits the cache instead of running its own check()
+    void decide_for_all_classes(InterfaceRecord* record) {
+        if (record->decided_for_all) {
+            return;
+        }
+        record->decided_for_all = true;
+        decide_for_all_classes(record->id);
+    }
+
+    void decide_for_all_classes(InterfaceId id) {
+        auto const deciders = policy->deciders_for(id);
+        class_table->decide_all(deciders, [id](ClientClass* client_class, Policy::Verdict const& verdict) {
+            if (!client_class->known.test(id)) {
+                client_class->known.set(id);
+                client_class->allowed.set(id, verdict.allowed);
+                Policy::trace_check(*client_class->policy_client, id, verdict);
+            }
+        });
+    }
+
+    /// The handle's ID in the current policy, only looked up by name the first time
+    auto queried_id(wl_bouncer_interface const* handle) -> InterfaceId {
+        if (handle->index < queried.size() && queried[handle->index].handle) {
+            return queried[handle->index].id;
+        }
+        if (handle->index >= queried.size()) {
+            queried.resize(handle->index + 1);
+        }
+        auto const id = policy->find_interface(handle->name);
+        queried[handle->index] = {handle, id};
+        // Queries usually come from every client using a protocol, so the other classes will need it soon
+        decide_for_all_classes(id);
+        return id;
+    }
+
+    /// Forgets every memoized wrapped filter result of the client, or of all clients if it is null
+    void invalidate_wrapped_filter(ClientCtx* client_ctx);
+
+    /// Keeps the buckets of limits that did not change, so reloading the policy does not reset them
+    void update_rate_limiters() {
+        for (size_t scope = 0; scope < Policy::rate_scopes; scope++) {
+            auto const& limit = policy->rate_limit(static_cast<Policy::RateScope>(scope));
+            auto& limiter = rate_limiters[scope];
+            if (!limit) {
+                limiter.reset();
+            } else if (!limiter || limiter->rate() != limit->rate || limiter->burst() != limit->burst) {
+                limiter = std::make_unique<RateLimiter>(limit->rate, limit->burst);
+            }
+        }
+    }
 };
 
 struct DisplayWrapper {
@@ -42,60 +320,445 @@ struct DisplayWrapper {
     {}
 };
 
-std::mutex DisplayCtx::display_map_mutex;
-std::unordered_map<wl_display*, DisplayCtx*> DisplayCtx::display_map;
-
 static_assert(
     std::is_standard_layout<DisplayWrapper>::value,
     "DisplayWrapper must be standard layout due to wl_container_of requirements");
 
-struct ClientCtx {
-    std::unordered_map<std::string, bool> cache;
-    std::shared_ptr<Policy::Client> policy_client;
-    DisplayCtx* display_ctx = nullptr;
-    wl_client const* client = nullptr;
-};
+void handle_client_destroyed(wl_listener* listener, void* data);
 
-struct ClientWrapper {
-    ClientCtx* const ctx;
-    wl_listener destroy_listener;
+/// Every display's context, for wl_bouncer_get_stats() on other threads. find_display_ctx() walks the display's
+/// listeners, which is only safe on its own thread. Contexts are removed under the lock before they are deleted.
+std::mutex stats_mutex;
+std::unordered_map<wl_display const*, DisplayCtx const*> stats_displays;
 
-    ClientWrapper(ClientCtx* ctx) :
-        ctx{ctx}
-    {}
-};
+/// Clients are found through their destroy listener rather than a map, wlbouncer's is added first so this is usually
+/// the first listener checked
+auto find_client_ctx(wl_client const* client) -> ClientCtx* {
+    auto const listener = wl_client_get_destroy_listener(const_cast<wl_client*>(client), &handle_client_destroyed);
+    if (!listener) {
+        return nullptr;
+    }
+    ClientCtx* client_ctx = wl_container_of(listener, client_ctx, destroy_listener);
+    return client_ctx;
+}
 
-static_assert(
-    std::is_standard_layout<ClientWrapper>::value,
-    "ClientWrapper must be standard layout due to wl_container_of requirements");
+void audit_decision(DisplayCtx* display_ctx, ClientCtx const* client_ctx, InterfaceRecord const* record, bool allowed) {
+    int32_t directive = -1;
+    if (auto const client_class = client_ctx->client_class.get()) {
+        // The decision cache does not keep which directive decided, but evaluating again is cheap
+        auto const verdict = display_ctx->policy->explain(*client_class->policy_client, record->id);
+        directive = verdict.directive ? static_cast<int32_t>(verdict.directive.value()) : -1;
+    }
+    display_ctx->audit->record(AuditRecord{
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count(),
+        client_ctx->pid,
+        client_ctx->uid,
+        client_ctx->gid,
+        directive,
+        &record->name,
+        allowed,
+    });
+}
+
+void capture_filter_call(
+    DisplayCtx* display_ctx,
+    uint32_t client,
+    wl_global const* global,
+    InterfaceRecord const* record,
+    bool tracked,
+    bool allowed,
+    CaptureEvent::Bypass bypass
+) {
+    display_ctx->capture->record(CaptureEvent{
+        CaptureEvent::Kind::filter,
+        0,
+        client,
+        0,
+        0,
+        0,
+        reinterpret_cast<uintptr_t>(global),
+        &record->name,
+        tracked,
+        allowed,
+        bypass,
+    });
+}
 
 auto filter_func(wl_client const* client, wl_global const* global, void* data) -> bool {
     auto const display_ctx = reinterpret_cast<DisplayCtx*>(data);
-    if (display_ctx->wrapped_filter) {
-        if (!display_ctx->wrapped_filter(client, global, display_ctx->wrapped_filter_data)) {
-            return false;
+    auto& stats = display_ctx->stats;
+    auto const calls = stats.filter_calls.load(std::memory_order_relaxed);
+    bump(stats.filter_calls);
+    auto const timed = calls % Stats::filter_sample_interval == 0;
+    auto const start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+    auto const client_ctx = find_client_ctx(client);
+    auto const tracked = display_ctx->globals.find(global);
+    auto const interface = tracked ? tracked->record->interface : wl_global_get_interface(global);
+    auto const name = interface->name;
+    // Every call fires filter__entry and filter__exit, unknown clients with pid and uid -1
+    [[maybe_unused]] auto const pid = client_ctx ? client_ctx->pid : -1;
+    [[maybe_unused]] auto const uid = client_ctx ? client_ctx->uid : static_cast<uid_t>(-1);
+    TRACE_PROBE3(filter__entry, pid, uid, name);
+    if (!client_ctx) {
+        std::cerr << "wlbouncer: unknown client " << client << std::endl;
+        if (display_ctx->capture) {
+            capture_filter_call(
+                display_ctx,
+                Capture::unknown_client,
+                global,
+                tracked ? tracked->record : display_ctx->interface_record(interface),
+                tracked.has_value(),
+                false,
+                CaptureEvent::Bypass::unknown_client);
         }
+        TRACE_PROBE4(filter__exit, pid, uid, name, false);
+        return false;
     }
-    auto client_ctx = display_ctx->clients.find(client);
-    if (client_ctx == display_ctx->clients.end()) {
-        std::cerr << "wlbouncer: unknown client " << client << std::endl;
+    if (display_ctx->wrapped_filter && !display_ctx->wrapped_filter_allows(client_ctx, global, tracked)) {
+        if (display_ctx->capture) {
+            capture_filter_call(
+                display_ctx,
+                client_ctx->capture_id,
+                global,
+                tracked ? tracked->record : display_ctx->interface_record(interface),
+                tracked.has_value(),
+                false,
+                CaptureEvent::Bypass::chained_filter);
+        }
+        TRACE_PROBE4(filter__exit, pid, uid, name, false);
         return false;
     }
-    std::string const interface_name = wl_global_get_interface(global)->name;
-    auto value = client_ctx->second->cache.find(interface_name);
-    if (value == client_ctx->second->cache.end()) {
-        auto const policy_client = client_ctx->second->policy_client.get();
-        auto const result = policy_client
-            ? display_ctx->policy.check(*policy_client, interface_name)
-            : false;
-        value = client_ctx->second->cache.insert({interface_name, result}).first;
-        if (bouncer_debug) {
-            std::cerr << "wlbouncer: " << interface_name
-                << (value->second ? " enabled" : " disabled")
+    auto const record = tracked ? tracked->record : display_ctx->interface_record(interface);
+    auto const client_class = client_ctx->client_class.get();
+    bool result = false;
+    if (client_class) {
+        auto const hit = client_class->known.test(record->id);
+        bump(hit ? stats.cache_hits : stats.cache_misses);
+        if (hit) {
+            TRACE_PROBE3(cache__hit, pid, uid, name);
+        } else {
+            TRACE_PROBE3(cache__miss, pid, uid, name);
+        }
+        if (!hit) {
+            // A miss on an interface no class has seen usually means a global was just created and every other
+            // client is about to be asked about it too
+            display_ctx->decide_for_all_classes(record);
+        }
+        result = client_class->decide(*display_ctx->policy, record->id);
+        if (!hit && bouncer_debug) {
+            std::cerr << "wlbouncer: " << name
+                << (result ? " enabled" : " disabled")
                 << std::endl;
         }
     }
-    return value->second;
+    if (display_ctx->audit && (!result || display_ctx->audit->logs_allowed())) {
+        audit_decision(display_ctx, client_ctx, record, result);
+    }
+    if (display_ctx->capture) {
+        capture_filter_call(
+            display_ctx,
+            client_ctx->capture_id,
+            global,
+            record,
+            tracked.has_value(),
+            result,
+            CaptureEvent::Bypass::none);
+    }
+    bump(result ? record->allowed : record->denied);
+    bump(result ? stats.allowed : stats.denied);
+    if (timed) {
+        stats.filter_latency.record(std::chrono::steady_clock::now() - start);
+    }
+    TRACE_PROBE4(filter__exit, pid, uid, name, result);
+    return result;
+}
+
+/// Names are only resolved in the background if resolve_async, clients can only be told about globals once they are
+/// if the compositor reports its globals. previous is the client's class under the policy being replaced, whose names
+/// and process attributes are reused rather than looked up again.
+auto find_or_create_class(
+    Policy const& policy,
+    ClassMap& classes,
+    ClassTable<ClientClass>& table,
+    ClientCtx& client_ctx,
+    bool resolve_async,
+    ClientClass const* previous = nullptr
+) -> std::shared_ptr<ClientClass> {
+    client_ctx.names_pending = false;
+    auto const key = policy.class_key(client_ctx.pid, client_ctx.uid, client_ctx.gid);
+    // Process attributes can differ between clients with equal keys, and PIDs get reused, so such classes are not
+    // shared
+    auto const shared = !policy.needs_process();
+    if (shared) {
+        auto const iter = classes.find(key);
+        if (iter != classes.end()) {
+            return iter->second;
+        }
+    }
+    if (auto policy_client = previous ? policy.rebind(*previous->policy_client) : nullptr) {
+        auto const client_class = std::make_shared<ClientClass>(
+            std::move(policy_client), policy.interfaces().size(), table);
+        if (shared) {
+            classes.insert({key, client_class});
+        }
+        return client_class;
+    }
+    NameResolver::Result user{NameResolver::Status::found, {}};
+    NameResolver::Result group{NameResolver::Status::found, {}};
+    // Without wl_global_get_name(), or the compositor reporting its globals, clients can not be told about globals
+    // once their names resolve, so they are resolved on the spot
+#ifdef HAVE_WL_GLOBAL_GET_NAME
+    auto const async = resolve_async;
+#else
+    (void)resolve_async;
+    auto const async = false;
+#endif
+    auto& resolver = NameResolver::get();
+    if (policy.needs_username()) {
+        user = async ? resolver.user(client_ctx.uid) : resolver.user_now(client_ctx.uid);
+    }
+    if (policy.needs_groupname()) {
+        group = async ? resolver.group(client_ctx.gid) : resolver.group_now(client_ctx.gid);
+    }
+    if (user.status == NameResolver::Status::pending || group.status == NameResolver::Status::pending) {
+        client_ctx.names_pending = true;
+        return nullptr;
+    }
+    // Not cached so a later client with the same credentials gets another chance once the negative result expires
+    if (user.status == NameResolver::Status::missing) {
+        std::cerr << "wlbouncer: failed to get username of user with uid = " << client_ctx.uid << std::endl;
+        return nullptr;
+    }
+    if (group.status == NameResolver::Status::missing) {
+        std::cerr << "wlbouncer: failed to get group name of user with gid = " << client_ctx.gid << std::endl;
+        return nullptr;
+    }
+    auto const client_class = std::make_shared<ClientClass>(
+        policy.client(client_ctx.pid, client_ctx.uid, client_ctx.gid, std::move(user.name), std::move(group.name)),
+        policy.interfaces().size(),
+        table);
+    if (shared) {
+        classes.insert({key, client_class});
+    }
+    return client_class;
+}
+
+struct RegistryEvent {
+    uint32_t opcode;
+    uint32_t name;
+    wl_global const* global;
+};
+
+/// Sends a global or global_remove event to each of the client's registries
+void send_registry_event(wl_client* client, RegistryEvent const& event) {
+    wl_client_for_each_resource(client, [](wl_resource* resource, void* data) {
+        auto const event = static_cast<RegistryEvent const*>(data);
+        if (strcmp(wl_resource_get_class(resource), "wl_registry") == 0) {
+            if (event->opcode == WL_REGISTRY_GLOBAL) {
+                wl_resource_post_event(
+                    resource,
+                    WL_REGISTRY_GLOBAL,
+                    event->name,
+                    wl_global_get_interface(event->global)->name,
+                    wl_global_get_version(event->global));
+            } else {
+                wl_resource_post_event(resource, WL_REGISTRY_GLOBAL_REMOVE, event->name);
+            }
+        }
+        return WL_ITERATOR_CONTINUE;
+    }, const_cast<RegistryEvent*>(&event));
+}
+
+/// Returns the global's registry name, or 0 if the client can not see it
+auto global_name(wl_global const* global, wl_client const* client) -> uint32_t {
+#ifdef HAVE_WL_GLOBAL_GET_NAME
+    return wl_global_get_name(global, client);
+#else
+    (void)global;
+    (void)client;
+    return 0;
+#endif
+}
+
+/// Registry events for clients whose decisions changed. Globals being hidden must still be visible to look up their
+/// registry names, so changes are collected before the new decisions take effect and sent after.
+class DecisionChanges {
+public:
+    void collect(
+        DisplayCtx* display_ctx,
+        ClientCtx* client_ctx,
+        ClientClass const* old_class,
+        ClientClass* new_class,
+        Policy const& new_policy
+    ) {
+        display_ctx->globals.for_each([&](wl_global const* global, TrackedGlobal const& tracked) {
+            // Clients only saw globals their class has made a decision on
+            auto const record = tracked.record;
+            auto const old_id = record->id;
+            auto const new_id = &new_policy == display_ctx->policy.get()
+                ? old_id
+                : new_policy.find_interface(record->interface->name);
+            auto const was_allowed = old_class && old_class->known.test(old_id) && old_class->allowed.test(old_id);
+            auto const is_allowed = new_class && new_class->decide(new_policy, new_id);
+            if (was_allowed == is_allowed) {
+                return;
+            }
+            if (display_ctx->wrapped_filter && !display_ctx->wrapped_filter_allows(client_ctx, global, tracked)) {
+                return;
+            }
+            if (is_allowed) {
+                added.push_back({client_ctx, {WL_REGISTRY_GLOBAL, 0, global}});
+            } else {
+                auto const name = global_name(global, client_ctx->client);
+                removed.push_back({client_ctx, {WL_REGISTRY_GLOBAL_REMOVE, name, global}});
+            }
+        });
+    }
+
+    /// Must be called once the new decisions are in effect
+    void send() {
+        for (auto& [client_ctx, event] : added) {
+            event.name = global_name(event.global, client_ctx->client);
+        }
+        for (auto const* events : {&removed, &added}) {
+            for (auto const& [client_ctx, event] : *events) {
+                if (event.name) {
+                    send_registry_event(client_ctx->client, event);
+                } else if (bouncer_debug) {
+                    std::cerr << "wlbouncer: can not notify client " << client_ctx->client << " that "
+                        << wl_global_get_interface(event.global)->name
+                        << (event.opcode == WL_REGISTRY_GLOBAL ? " was enabled" : " was disabled") << std::endl;
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<std::pair<ClientCtx*, RegistryEvent>> added;
+    std::vector<std::pair<ClientCtx*, RegistryEvent>> removed;
+};
+
+/// Installs a reloaded policy and tells clients about globals that appeared or disappeared for them
+void swap_policy(DisplayCtx* display_ctx, std::shared_ptr<Policy const> policy) {
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: applying reloaded policy" << std::endl;
+    }
+    bump(display_ctx->stats.policy_loads);
+    display_ctx->stats.policy_load_ns.store(policy->load_duration().count(), std::memory_order_relaxed);
+    ClassMap classes;
+    auto table = std::make_unique<ClassTable<ClientClass>>(policy->directive_count());
+    DecisionChanges changes;
+    std::vector<std::pair<ClientCtx*, std::shared_ptr<ClientClass>>> new_classes;
+    ClientCtx* client_ctx;
+    wl_list_for_each(client_ctx, &display_ctx->clients, link) {
+        if (client_ctx->reject_source) {
+            continue;
+        }
+        auto new_class = find_or_create_class(
+            *policy,
+            classes,
+            *table,
+            *client_ctx,
+            display_ctx->resolves_names_async(),
+            client_ctx->client_class.get());
+        changes.collect(display_ctx, client_ctx, client_ctx->client_class.get(), new_class.get(), *policy);
+        new_classes.push_back({client_ctx, std::move(new_class)});
+    }
+    display_ctx->policy = std::move(policy);
+    display_ctx->classes = std::move(classes);
+    // Old classes remove themselves from the old table as the last clients let go of them below
+    auto const old_table = std::exchange(display_ctx->class_table, std::move(table));
+    display_ctx->update_rate_limiters();
+    for (auto& [interface, record] : display_ctx->interfaces) {
+        record.id = display_ctx->policy->find_interface(interface->name);
+        record.decided_for_all = false;
+    }
+    for (auto& queried : display_ctx->queried) {
+        if (queried.handle) {
+            queried.id = display_ctx->policy->find_interface(queried.handle->name);
+            display_ctx->decide_for_all_classes(queried.id);
+        }
+    }
+    for (auto& [client_ctx, client_class] : new_classes) {
+        client_ctx->client_class = std::move(client_class);
+    }
+    changes.send();
+}
+
+/// Gives clients that were waiting on the NameResolver their decisions
+auto handle_names_resolved(int fd, uint32_t, void* data) -> int {
+    auto const display_ctx = static_cast<DisplayCtx*>(data);
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    DecisionChanges changes;
+    ClientCtx* client_ctx;
+    wl_list_for_each(client_ctx, &display_ctx->clients, link) {
+        if (client_ctx->names_pending) {
+            auto const policy = display_ctx->policy.get();
+            client_ctx->client_class = find_or_create_class(
+                *policy, display_ctx->classes, *display_ctx->class_table, *client_ctx, true);
+            changes.collect(display_ctx, client_ctx, nullptr, client_ctx->client_class.get(), *policy);
+        }
+    }
+    // Unlike a policy swap nothing is being hidden, so the new classes can be installed before collecting
+    changes.send();
+    return 0;
+}
+
+/// Calls f(name, allowed, denied) for each interface, merging records of different structs with the same name
+template<typename F>
+void for_each_interface_stats(DisplayCtx const* display_ctx, F&& f) {
+    std::map<std::string_view, std::pair<uint64_t, uint64_t>> merged;
+    for (auto const& [interface, record] : display_ctx->interfaces) {
+        auto& counts = merged[interface->name];
+        counts.first += record.allowed.load(std::memory_order_relaxed);
+        counts.second += record.denied.load(std::memory_order_relaxed);
+    }
+    for (auto const& [name, counts] : merged) {
+        f(name.data(), counts.first, counts.second);
+    }
+}
+
+void print_histogram(char const* name, uint64_t const* buckets) {
+    std::cerr << "wlbouncer:   " << name << ":";
+    for (size_t i = 0; i < WL_BOUNCER_HISTOGRAM_BUCKETS; i++) {
+        if (buckets[i]) {
+            std::cerr << " " << (uint64_t{1} << i) << "ns:" << buckets[i];
+        }
+    }
+    std::cerr << std::endl;
+}
+
+auto handle_stats_signal(int, void* data) -> int {
+    auto const display_ctx = static_cast<DisplayCtx*>(data);
+    wl_bouncer_stats stats;
+    display_ctx->stats.copy_to(&stats);
+    stats.name_lookups = NameResolver::get().lookup_count();
+    stats.name_lookup_ns = NameResolver::get().lookup_ns();
+    std::cerr << "wlbouncer: stats for display context " << display_ctx << std::endl
+        << "wlbouncer:   filter calls: " << stats.filter_calls
+        << ", cache hits: " << stats.cache_hits
+        << ", cache misses: " << stats.cache_misses
+        << ", allowed: " << stats.allowed
+        << ", denied: " << stats.denied
+        << ", chained filter calls: " << stats.chained_filter_calls
+        << ", queries: " << stats.queries << std::endl
+        << "wlbouncer:   clients created: " << stats.clients_created
+        << ", clients destroyed: " << stats.clients_destroyed
+        << ", clients rejected: " << stats.clients_rejected << std::endl
+        << "wlbouncer:   policy loads: " << stats.policy_loads
+        << ", last load: " << stats.policy_load_ns << "ns" << std::endl
+        << "wlbouncer:   name lookups: " << stats.name_lookups
+        << ", total lookup time: " << stats.name_lookup_ns << "ns" << std::endl;
+    print_histogram("filter latency (sampled)", stats.filter_latency);
+    print_histogram("client created latency", stats.client_created_latency);
+    for_each_interface_stats(display_ctx, [](char const* name, uint64_t allowed, uint64_t denied) {
+        std::cerr << "wlbouncer:   " << name << ": allowed " << allowed << ", denied " << denied << std::endl;
+    });
+    return 0;
 }
 
 void handle_client_destroyed(wl_listener* listener, void* data) {
@@ -103,28 +766,113 @@ void handle_client_destroyed(wl_listener* listener, void* data) {
     if (bouncer_debug) {
         std::cerr << "wlbouncer: client " << client << " destroyed" << std::endl;
     }
-    ClientWrapper* wrapper = wl_container_of(listener, wrapper, destroy_listener);
-    ClientCtx* ctx = wrapper->ctx;
-    ctx->display_ctx->clients.erase(client);
-    delete wrapper;
-    delete ctx;
+    ClientCtx* client_ctx = wl_container_of(listener, client_ctx, destroy_listener);
+    auto const display_ctx = client_ctx->display_ctx;
+    bump(display_ctx->stats.clients_destroyed);
+    TRACE_PROBE2(client__destroyed, client_ctx->pid, client_ctx->uid);
+    if (display_ctx->capture) {
+        display_ctx->capture->record(CaptureEvent{
+            CaptureEvent::Kind::client_destroyed,
+            0,
+            client_ctx->capture_id,
+            0,
+            0,
+            0,
+            0,
+            nullptr,
+            false,
+            false,
+            CaptureEvent::Bypass::none,
+        });
+    }
+    if (client_ctx->reject_source) {
+        wl_event_source_remove(client_ctx->reject_source);
+    }
+    wl_list_remove(&client_ctx->link);
+    display_ctx->client_slab.destroy(client_ctx);
+}
+
+/// Takes a token from each limited scope's bucket, returns false if the client is over any of the limits
+auto within_rate_limits(
+    DisplayCtx* display_ctx,
+    ClientCtx const& client_ctx,
+    std::chrono::steady_clock::time_point now
+) -> bool {
+    auto const& limiters = display_ctx->rate_limiters;
+    // The key is only computed for limited scopes, since the class key is not free
+    auto const take = [&](Policy::RateScope scope, char const* name, auto const& key_func) {
+        auto const& limiter = limiters[static_cast<size_t>(scope)];
+        if (!limiter || limiter->take(key_func(), now)) {
+            return true;
+        }
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: " << client_ctx.pid << " from uid " << client_ctx.uid
+                << " is over the " << name << " connection rate limit" << std::endl;
+        }
+        return false;
+    };
+    return
+        take(Policy::RateScope::uid, "uid", [&]() { return uint64_t{client_ctx.uid}; }) &&
+        take(Policy::RateScope::pid, "pid", [&]() { return static_cast<uint64_t>(client_ctx.pid); }) &&
+        take(Policy::RateScope::client_class, "class", [&]() {
+            auto const key = display_ctx->policy->class_key(client_ctx.pid, client_ctx.uid, client_ctx.gid);
+            return uint64_t{Policy::ClassKey::Hash{}(key)};
+        });
+}
+
+/// The client can not be destroyed from its own created signal, since wl_client_create() still returns it
+void handle_rejected(void* data) {
+    auto const client_ctx = static_cast<ClientCtx*>(data);
+    client_ctx->reject_source = nullptr;
+    wl_client_destroy(client_ctx->client);
 }
 
 void handle_client_created(wl_listener* listener, void* data) {
     DisplayWrapper* display_wrapper = wl_container_of(listener, display_wrapper, client_construction_listener);
     DisplayCtx* display_ctx = display_wrapper->ctx;
     auto const client = reinterpret_cast<wl_client*>(data);
+    auto const start = std::chrono::steady_clock::now();
     if (bouncer_debug) {
         std::cerr << "wlbouncer: client " << client << " created" << std::endl;
     }
-    auto const client_ctx = new ClientCtx{};
-    auto const client_wrapper = new ClientWrapper{client_ctx};
-    display_ctx->clients.insert({client, client_ctx});
-    client_ctx->display_ctx = display_ctx;
-    client_ctx->client = client;
-    client_ctx->policy_client = display_ctx->policy.client(client);
-    client_wrapper->destroy_listener.notify = &handle_client_destroyed;
-    wl_client_add_destroy_listener(client, &client_wrapper->destroy_listener);
+    auto const client_ctx = display_ctx->client_slab.create(display_ctx, client);
+    wl_list_insert(&display_ctx->clients, &client_ctx->link);
+    wl_client_get_credentials(client, &client_ctx->pid, &client_ctx->uid, &client_ctx->gid);
+    if (display_ctx->capture) {
+        // Recorded before the rate limits are applied, so replaying the capture applies them again
+        client_ctx->capture_id = display_ctx->capture->next_client();
+        display_ctx->capture->record(CaptureEvent{
+            CaptureEvent::Kind::client_created,
+            0,
+            client_ctx->capture_id,
+            client_ctx->pid,
+            client_ctx->uid,
+            client_ctx->gid,
+            0,
+            nullptr,
+            false,
+            false,
+            CaptureEvent::Bypass::none,
+        });
+    }
+    if (within_rate_limits(display_ctx, *client_ctx, start)) {
+        client_ctx->client_class = find_or_create_class(
+            *display_ctx->policy,
+            display_ctx->classes,
+            *display_ctx->class_table,
+            *client_ctx,
+            display_ctx->resolves_names_async());
+    } else {
+        // Runs before the client's first request is read, so it never gets as far as the registry
+        client_ctx->reject_source = wl_event_loop_add_idle(
+            wl_display_get_event_loop(wl_client_get_display(client)), &handle_rejected, client_ctx);
+        bump(display_ctx->stats.clients_rejected);
+    }
+    client_ctx->destroy_listener.notify = &handle_client_destroyed;
+    wl_client_add_destroy_listener(client, &client_ctx->destroy_listener);
+    bump(display_ctx->stats.clients_created);
+    TRACE_PROBE4(client__created, client_ctx->pid, client_ctx->uid, client_ctx->gid, !client_ctx->reject_source);
+    display_ctx->stats.client_created_latency.record(std::chrono::steady_clock::now() - start);
 }
 
 void handle_display_destroyed(wl_listener* listener, void* data) {
@@ -132,15 +880,106 @@ void handle_display_destroyed(wl_listener* listener, void* data) {
     if (bouncer_debug) {
         std::cerr << "wlbouncer: display " << display << " destroyed" << std::endl;
     }
-    DisplayWrapper* display_wrapper = wl_container_of(listener, display_wrapper, client_construction_listener);
+    DisplayWrapper* display_wrapper = wl_container_of(listener, display_wrapper, display_destruction_listener);
     DisplayCtx* display_ctx = display_wrapper->ctx;
     {
-        std::lock_guard lock{DisplayCtx::display_map_mutex};
-        DisplayCtx::display_map.erase(display);
+        std::lock_guard lock{stats_mutex};
+        stats_displays.erase(display);
+    }
+    // Clients that outlive the display must not call back into its slab
+    ClientCtx* client_ctx;
+    ClientCtx* next;
+    wl_list_for_each_safe(client_ctx, next, &display_ctx->clients, link) {
+        if (client_ctx->reject_source) {
+            wl_event_source_remove(client_ctx->reject_source);
+        }
+        wl_list_remove(&client_ctx->destroy_listener.link);
+        display_ctx->client_slab.destroy(client_ctx);
     }
     delete display_wrapper;
     delete display_ctx;
 }
+
+auto find_display_ctx(wl_display* display) -> DisplayCtx* {
+    // Found through the display's own destroy listener, so displays on different threads share no state
+    auto const listener = wl_display_get_destroy_listener(display, &handle_display_destroyed);
+    if (!listener) {
+        return nullptr;
+    }
+    DisplayWrapper* display_wrapper = wl_container_of(listener, display_wrapper, display_destruction_listener);
+    return display_wrapper->ctx;
+}
+
+/// Reloads the policy whenever its config file changes, unless BOUNCER_NO_RELOAD is set
+void watch_policy(DisplayCtx* display_ctx, wl_event_loop* loop) {
+    if (display_ctx->policy->path().empty() || getenv("BOUNCER_NO_RELOAD")) {
+        return;
+    }
+    display_ctx->watcher = std::make_unique<PolicyWatcher>(
+        loop,
+        display_ctx->policy->path(),
+        [display_ctx](std::shared_ptr<Policy const> policy) {
+            swap_policy(display_ctx, std::move(policy));
+        });
+}
+
+void DisplayCtx::invalidate_wrapped_filter(ClientCtx* client_ctx) {
+    if (client_ctx) {
+        client_ctx->filter_known.clear();
+        return;
+    }
+    wl_list_for_each(client_ctx, &clients, link) {
+        client_ctx->filter_known.clear();
+    }
+}
+
+/// Hooks a DisplayCtx that already has a policy up to its display
+void init_display_ctx(
+    wl_display* display,
+    DisplayCtx* display_ctx,
+    wl_display_global_filter_func_t filter,
+    void* filter_data,
+    bool filter_pure
+) {
+    auto const display_wrapper = new DisplayWrapper{display_ctx};
+    display_ctx->wrapped_filter = filter;
+    display_ctx->wrapped_filter_data = filter_data;
+    display_ctx->wrapped_filter_pure = filter_pure;
+    display_ctx->names_source = wl_event_loop_add_fd(
+        wl_display_get_event_loop(display),
+        display_ctx->names_fd,
+        WL_EVENT_READABLE,
+        &handle_names_resolved,
+        display_ctx);
+    if (auto const signal_name = getenv("BOUNCER_STATS_SIGNAL")) {
+        auto const signal_number = atoi(signal_name);
+        display_ctx->stats_signal_source = wl_event_loop_add_signal(
+            wl_display_get_event_loop(display),
+            signal_number > 0 ? signal_number : SIGUSR1,
+            &handle_stats_signal,
+            display_ctx);
+    }
+    if (auto const audit_path = getenv("BOUNCER_AUDIT")) {
+        auto const format = getenv("BOUNCER_AUDIT_FORMAT");
+        display_ctx->audit = AuditLog::open(
+            audit_path,
+            format && strcmp(format, "binary") == 0 ? AuditLog::Format::binary : AuditLog::Format::json,
+            getenv("BOUNCER_AUDIT_ALL"));
+    }
+    if (auto const capture_path = getenv("BOUNCER_CAPTURE")) {
+        display_ctx->capture = Capture::open(capture_path);
+    }
+    display_wrapper->client_construction_listener.notify = &handle_client_created;
+    wl_display_add_client_created_listener(display, &display_wrapper->client_construction_listener);
+    // This handles deleting DisplayCtx when display is destoryed
+    display_wrapper->display_destruction_listener.notify = &handle_display_destroyed;
+    wl_display_add_destroy_listener(display, &display_wrapper->display_destruction_listener);
+    {
+        std::lock_guard lock{stats_mutex};
+        stats_displays[display] = display_ctx;
+    }
+    real_wl_display_set_global_filter(display, filter_func, display_ctx);
+}
 }
 
 void set_wrapped_display_filter(
@@ -148,44 +987,194 @@ void set_wrapped_display_filter(
     wl_display_global_filter_func_t filter,
     void *data
 ) {
-    DisplayCtx* display_ctx;
-    {
-        std::lock_guard lock{DisplayCtx::display_map_mutex};
-        auto const iter = DisplayCtx::display_map.find(display);
-        if (iter == DisplayCtx::display_map.end()) {
-            std::cerr << "wlbouncer: invalid display " << display << std::endl;
-            return;
-        }
-        display_ctx = iter->second;
+    auto const display_ctx = find_display_ctx(display);
+    if (!display_ctx) {
+        std::cerr << "wlbouncer: invalid display " << display << std::endl;
+        return;
     }
     display_ctx->wrapped_filter = filter;
     display_ctx->wrapped_filter_data = data;
+    // Results of the previous filter say nothing about this one
+    display_ctx->invalidate_wrapped_filter(nullptr);
 }
 
 extern "C" {
 
+void wl_bouncer_global_created(wl_global* global) {
+    auto const display_ctx = find_display_ctx(wl_global_get_display(global));
+    if (!display_ctx) {
+        return;
+    }
+    auto const record = display_ctx->interface_record(wl_global_get_interface(global));
+    auto& free_indexes = display_ctx->free_global_indexes;
+    uint32_t index;
+    if (free_indexes.empty()) {
+        index = display_ctx->global_index_count++;
+    } else {
+        index = free_indexes.back();
+        free_indexes.pop_back();
+    }
+    display_ctx->globals.insert(global, {record, index});
+    // Decide for every class now rather than having every client miss the cache when the global is advertised
+    display_ctx->decide_for_all_classes(record);
+}
+
+void wl_bouncer_global_destroyed(wl_global* global) {
+    auto const display_ctx = find_display_ctx(wl_global_get_display(global));
+    if (!display_ctx) {
+        return;
+    }
+    auto const tracked = display_ctx->globals.find(global);
+    if (!tracked) {
+        return;
+    }
+    display_ctx->globals.erase(global);
+    // The index goes to the next global created, which must not inherit memoized results
+    ClientCtx* client_ctx;
+    wl_list_for_each(client_ctx, &display_ctx->clients, link) {
+        client_ctx->filter_known.set(tracked->index, false);
+    }
+    display_ctx->free_global_indexes.push_back(tracked->index);
+}
+
+bool wl_bouncer_get_stats(wl_display* display, wl_bouncer_stats* stats) {
+    if (stats->struct_size < offsetof(wl_bouncer_stats, filter_calls) + sizeof(stats->filter_calls)) {
+        return false;
+    }
+    wl_bouncer_stats all;
+    {
+        std::lock_guard lock{stats_mutex};
+        auto const iter = stats_displays.find(display);
+        if (iter == stats_displays.end()) {
+            return false;
+        }
+        iter->second->stats.copy_to(&all);
+    }
+    all.name_lookups = NameResolver::get().lookup_count();
+    all.name_lookup_ns = NameResolver::get().lookup_ns();
+    // A caller built against an older header has a shorter struct, newer counters are left out
+    all.struct_size = std::min<uint32_t>(stats->struct_size, sizeof(all));
+    memcpy(stats, &all, all.struct_size);
+    return true;
+}
+
+void wl_bouncer_for_each_interface_stats(
+    wl_display* display,
+    wl_bouncer_interface_stats_func_t func,
+    void* data
+) {
+    auto const display_ctx = find_display_ctx(display);
+    if (!display_ctx) {
+        return;
+    }
+    for_each_interface_stats(display_ctx, [&](char const* name, uint64_t allowed, uint64_t denied) {
+        func(name, allowed, denied, data);
+    });
+}
+
+void wl_bouncer_invalidate(wl_display* display, wl_client const* client) {
+    auto const display_ctx = find_display_ctx(display);
+    if (!display_ctx) {
+        return;
+    }
+    if (!client) {
+        display_ctx->invalidate_wrapped_filter(nullptr);
+    } else if (auto const client_ctx = find_client_ctx(client)) {
+        display_ctx->invalidate_wrapped_filter(client_ctx);
+    }
+}
+
+wl_bouncer_interface const* wl_bouncer_resolve_interface(char const* name) {
+    if (!name) {
+        return nullptr;
+    }
+    static std::mutex mutex;
+    // A deque so handles never move, keyed by their own names
+    static std::deque<wl_bouncer_interface> handles;
+    static std::unordered_map<std::string_view, wl_bouncer_interface const*> by_name;
+    std::lock_guard lock{mutex};
+    auto const iter = by_name.find(name);
+    if (iter != by_name.end()) {
+        return iter->second;
+    }
+    auto const& handle = handles.emplace_back(name, static_cast<uint32_t>(handles.size()));
+    by_name.emplace(handle.name, &handle);
+    return &handle;
+}
+
+bool wl_bouncer_query(wl_display* display, wl_client const* client, wl_bouncer_interface const* interface) {
+    auto const display_ctx = find_display_ctx(display);
+    if (!display_ctx || !interface) {
+        return false;
+    }
+    auto const client_ctx = find_client_ctx(client);
+    // The class and the interface ID would come from different policies
+    if (!client_ctx || client_ctx->display_ctx != display_ctx) {
+        return false;
+    }
+    bump(display_ctx->stats.queries);
+    auto const client_class = client_ctx->client_class.get();
+    if (!client_class) {
+        return false;
+    }
+    return client_class->decide(*display_ctx->policy, display_ctx->queried_id(interface));
+}
+
 void wl_bouncer_init_for_display(
     wl_display* display,
     const char* config_file,
     wl_display_global_filter_func_t filter,
     void* filter_data
 ) {
-    if (bouncer_debug) {
-        std::cerr << "wlbouncer: initializing for display " << display << std::endl;
+    wl_bouncer_init_for_display_with_flags(display, config_file, filter, filter_data, 0);
+}
+
+void wl_bouncer_init_for_display_async(
+    wl_display* display,
+    const char* config_file,
+    wl_display_global_filter_func_t filter,
+    void* filter_data,
+    bool fail_closed
+) {
+    wl_bouncer_init_for_display_with_flags(
+        display,
+        config_file,
+        filter,
+        filter_data,
+        WL_BOUNCER_INIT_ASYNC | (fail_closed ? WL_BOUNCER_INIT_FAIL_CLOSED : 0));
+}
+
+void wl_bouncer_init_for_display_with_flags(
+    wl_display* display,
+    const char* config_file,
+    wl_display_global_filter_func_t filter,
+    void* filter_data,
+    uint32_t flags
+) {
+    auto const filter_pure = (flags & WL_BOUNCER_INIT_FILTER_PURE) != 0;
+    if (!(flags & WL_BOUNCER_INIT_ASYNC)) {
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: initializing for display " << display << std::endl;
+        }
+        auto const display_ctx = new DisplayCtx{shared_policy(config_file)};
+        watch_policy(display_ctx, wl_display_get_event_loop(display));
+        init_display_ctx(display, display_ctx, filter, filter_data, filter_pure);
+        return;
     }
-    auto display_ctx = new DisplayCtx{config_file};
-    auto display_wrapper = new DisplayWrapper{display_ctx};
-    {
-        std::lock_guard lock{DisplayCtx::display_map_mutex};
-        DisplayCtx::display_map[display] = display_ctx;
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: initializing for display " << display << ", loading policy in the background"
+            << std::endl;
     }
-    display_ctx->wrapped_filter = filter;
-    display_ctx->wrapped_filter_data = filter_data;
-    display_wrapper->client_construction_listener.notify = &handle_client_created;
-    wl_display_add_client_created_listener(display, &display_wrapper->client_construction_listener);
-    // This handles deleting DisplayCtx when display is destoryed
-    display_wrapper->display_destruction_listener.notify = &handle_display_destroyed;
-    wl_display_add_destroy_listener(display, &display_wrapper->display_destruction_listener);
-    real_wl_display_set_global_filter(display, filter_func, display_ctx);
+    auto const display_ctx = new DisplayCtx{Policy::placeholder(!(flags & WL_BOUNCER_INIT_FAIL_CLOSED))};
+    init_display_ctx(display, display_ctx, filter, filter_data, filter_pure);
+    auto const loop = wl_display_get_event_loop(display);
+    display_ctx->loader = std::make_unique<PolicyLoader>(
+        loop,
+        config_file,
+        [display_ctx, loop](std::shared_ptr<Policy const> policy) {
+            // Clients that connected in the meantime were decided by the placeholder and get re-evaluated here
+            swap_policy(display_ctx, std::move(policy));
+            watch_policy(display_ctx, loop);
+        });
 }
 }
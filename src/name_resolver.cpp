@@ -0,0 +1,141 @@
+#include "name_resolver.h"
+#include <cerrno>
+#include <iostream>
+#include <thread>
+#include <pwd.h>
+#include <grp.h>
+
+extern bool bouncer_debug;
+
+// The reentrant variants are used because lookups happen off the main thread
+auto resolve_username(uid_t uid) -> std::optional<std::string> {
+    passwd pw;
+    passwd* result = nullptr;
+    std::vector<char> buffer(1024);
+    while (getpwuid_r(uid, &pw, buffer.data(), buffer.size(), &result) == ERANGE) {
+        buffer.resize(buffer.size() * 2);
+    }
+    if (!result) {
+        return std::nullopt;
+    }
+    return pw.pw_name;
+}
+
+auto resolve_groupname(gid_t gid) -> std::optional<std::string> {
+    group g;
+    group* result = nullptr;
+    std::vector<char> buffer(1024);
+    while (getgrgid_r(gid, &g, buffer.data(), buffer.size(), &result) == ERANGE) {
+        buffer.resize(buffer.size() * 2);
+    }
+    if (!result) {
+        return std::nullopt;
+    }
+    return g.gr_name;
+}
+
+auto NameResolver::get() -> NameResolver& {
+    // Never destroyed, the worker may be blocked in NSS when the process exits
+    static auto const resolver = new NameResolver{};
+    return *resolver;
+}
+
+auto NameResolver::user(uid_t uid) -> Result {
+    return lookup(users, true, uid);
+}
+
+auto NameResolver::group(gid_t gid) -> Result {
+    return lookup(groups, false, gid);
+}
+
+auto NameResolver::user_now(uid_t uid) -> Result {
+    return lookup_now(users, true, uid);
+}
+
+auto NameResolver::group_now(gid_t gid) -> Result {
+    return lookup_now(groups, false, gid);
+}
+
+void NameResolver::add_listener(int event_fd) {
+    std::lock_guard lock{mutex};
+    listeners.push_back(event_fd);
+}
+
+void NameResolver::remove_listener(int event_fd) {
+    std::lock_guard lock{mutex};
+    std::erase(listeners, event_fd);
+}
+
+auto NameResolver::lookup(std::unordered_map<uint32_t, Entry>& entries, bool is_user, uint32_t id) -> Result {
+    std::lock_guard lock{mutex};
+    auto iter = entries.find(id);
+    if (iter == entries.end()) {
+        iter = entries.insert({id, Entry{Status::pending, {}, {}, false}}).first;
+    }
+    auto& entry = iter->second;
+    if (!entry.queued && (entry.status == Status::pending || Clock::now() >= entry.expires)) {
+        entry.queued = true;
+        queue.push_back({is_user, id});
+        if (!worker_started) {
+            worker_started = true;
+            std::thread{[this]() { run(); }}.detach();
+        }
+        queue_changed.notify_one();
+    }
+    return Result{entry.status, entry.name};
+}
+
+auto NameResolver::lookup_now(std::unordered_map<uint32_t, Entry>& entries, bool is_user, uint32_t id) -> Result {
+    {
+        std::lock_guard lock{mutex};
+        auto const iter = entries.find(id);
+        if (iter != entries.end() && iter->second.status != Status::pending && Clock::now() < iter->second.expires) {
+            return Result{iter->second.status, iter->second.name};
+        }
+    }
+    auto const name = resolve(is_user, id);
+    std::lock_guard lock{mutex};
+    store(is_user, id, name, Clock::now());
+    return Result{name ? Status::found : Status::missing, name.value_or("")};
+}
+
+auto NameResolver::resolve(bool is_user, uint32_t id) -> std::optional<std::string> {
+    auto const start = Clock::now();
+    auto const name = is_user ? resolve_username(id) : resolve_groupname(id);
+    auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+    lookups.fetch_add(1, std::memory_order_relaxed);
+    lookup_time_ns.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: resolved " << (is_user ? "uid " : "gid ") << id
+            << " to " << name.value_or("nothing") << " in "
+            << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << "us" << std::endl;
+    }
+    return name;
+}
+
+void NameResolver::store(bool is_user, uint32_t id, std::optional<std::string> const& name, Clock::time_point now) {
+    auto& entry = (is_user ? users : groups)[id];
+    entry.status = name ? Status::found : Status::missing;
+    entry.name = name.value_or("");
+    entry.expires = now + (name ? Clock::duration{found_ttl} : Clock::duration{missing_ttl});
+}
+
+void NameResolver::run() {
+    std::unique_lock lock{mutex};
+    while (true) {
+        queue_changed.wait(lock, [this]() { return !queue.empty(); });
+        auto const request = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        auto const name = resolve(request.is_user, request.id);
+        lock.lock();
+        store(request.is_user, request.id, name, Clock::now());
+        (request.is_user ? users : groups)[request.id].queued = false;
+        uint64_t const count = 1;
+        for (auto const fd : listeners) {
+            if (write(fd, &count, sizeof(count)) != sizeof(count)) {
+                std::cerr << "wlbouncer: failed to signal resolved name" << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef WL_BOUNCER_NAME_RESOLVER_H
+#define WL_BOUNCER_NAME_RESOLVER_H
+
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Blocking lookups, return nullopt if the ID has no name
+auto resolve_username(uid_t uid) -> std::optional<std::string>;
+auto resolve_groupname(gid_t gid) -> std::optional<std::string>;
+
+/// Process-wide cache of user and group names, filled by a background thread so NSS backends that go over the network
+/// never stall the compositor. Expired entries keep being returned while they are refreshed.
+class NameResolver {
+public:
+    enum class Status {
+        pending,
+        found,
+        missing,
+    };
+
+    struct Result {
+        Status status;
+        std::string name;
+    };
+
+    static auto get() -> NameResolver&;
+
+    /// Returns the cached name, or queues a lookup and returns pending
+    auto user(uid_t uid) -> Result;
+    auto group(gid_t gid) -> Result;
+    /// Returns the cached name, or looks it up on the calling thread and caches the result
+    auto user_now(uid_t uid) -> Result;
+    auto group_now(gid_t gid) -> Result;
+
+    /// The eventfd is written to each time a queued lookup finishes
+    void add_listener(int event_fd);
+    void remove_listener(int event_fd);
+
+    /// How many lookups were done and how long they took in total
+    auto lookup_count() const -> uint64_t { return lookups.load(std::memory_order_relaxed); }
+    auto lookup_ns() const -> uint64_t { return lookup_time_ns.load(std::memory_order_relaxed); }
+
+private:
+    NameResolver() = default;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Status status;
+        std::string name;
+        Clock::time_point expires;
+        bool queued;
+    };
+
+    struct Request {
+        bool is_user;
+        uint32_t id;
+    };
+
+    static constexpr auto found_ttl = std::chrono::minutes{5};
+    static constexpr auto missing_ttl = std::chrono::seconds{30};
+
+    std::mutex mutex;
+    std::condition_variable queue_changed;
+    std::unordered_map<uint32_t, Entry> users;
+    std::unordered_map<uint32_t, Entry> groups;
+    std::deque<Request> queue;
+    std::vector<int> listeners;
+    bool worker_started = false;
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> lookup_time_ns{0};
+
+    auto lookup(std::unordered_map<uint32_t, Entry>& entries, bool is_user, uint32_t id) -> Result;
+    auto lookup_now(std::unordered_map<uint32_t, Entry>& entries, bool is_user, uint32_t id) -> Result;
+    auto resolve(bool is_user, uint32_t id) -> std::optional<std::string>;
+    void store(bool is_user, uint32_t id, std::optional<std::string> const& name, Clock::time_point now);
+    void run();
+};
+
+#endif // WL_BOUNCER_NAME_RESOLVER_H
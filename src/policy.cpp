@@ -1,58 +1,74 @@
 #include "policy.h"
+#include "name_resolver.h"
+#include "compiled_policy.h"
+#include "known_interfaces.h"
+#include "process_info.h"
+#include "trace.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
 #include <iostream>
-#include <wayland-server-core.h>
-#include <pwd.h>
-#include <grp.h>
 #include <yaml-cpp/yaml.h>
 #include <set>
 #include <functional>
 #include <optional>
 #include <filesystem>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 extern bool bouncer_debug;
 
 namespace {
 
-static const std::set<std::string> default_extensions {
+/// Kept sorted, so the defaults get the same IDs in every policy and compiled policies can check them by position
+constexpr std::array<std::string_view, 19> default_extensions {
+    "org_kde_kwin_server_decoration_manager",
     "wl_compositor",
-    "wl_subcompositor",
     "wl_data_device_manager",
-    "wl_shm",
-    "wl_seat",
     "wl_output",
-    "xdg_wm_base",
-    "xdg_activation_v1",
+    "wl_seat",
+    "wl_shm",
+    "wl_subcompositor",
     "wp_presentation",
-    "wp_viewporter",
     "wp_single_pixel_buffer_manager_v1",
-    "zxdg_output_manager_v1",
-    "zxdg_decoration_manager_v1",
+    "wp_viewporter",
+    "xdg_activation_v1",
+    "xdg_wm_base",
     "zwp_relative_pointer_manager_v1",
     "zwp_tablet_manager_v2",
-    "zwp_text_input_manager_v3",
-    "zwp_text_input_manager_v2",
     "zwp_text_input_manager_v1",
-    "org_kde_kwin_server_decoration_manager",
+    "zwp_text_input_manager_v2",
+    "zwp_text_input_manager_v3",
+    "zxdg_decoration_manager_v1",
+    "zxdg_output_manager_v1",
 };
 
-using ConditionList = std::vector<std::function<bool(Policy::Client const&)>>;
+/// Indexes of the defaults in the known interface table, not_known for those not in any protocol found at build time
+constexpr auto known_default_extensions = [] {
+    std::array<int32_t, default_extensions.size()> result{};
+    for (size_t i = 0; i < default_extensions.size(); i++) {
+        result[i] = known_interfaces::find(default_extensions[i]);
+    }
+    return result;
+}();
 
 auto get_username(uid_t uid) -> std::string {
-    passwd const* const pw = getpwuid(uid);
-    if (!pw) {
+    auto const name = resolve_username(uid);
+    if (!name) {
         throw std::runtime_error{"failed to get username of user with uid = " + std::to_string(uid)};
-        return nullptr;
     }
-    return pw->pw_name;
+    return name.value();
 }
 
 auto get_groupname(gid_t gid) -> std::string {
-    group const* const g = getgrgid(gid);
-    if (!g) {
+    auto const name = resolve_groupname(gid);
+    if (!name) {
         throw std::runtime_error{"failed to get group name of user with gid = " + std::to_string(gid)};
-        return nullptr;
     }
-    return g->gr_name;
+    return name.value();
 }
 }
 
@@ -62,116 +78,446 @@ struct Policy::Client {
     gid_t const gid;
     std::string const username;
     std::string const groupname;
+    /// Bit i is set if all the conditions of directive i match this client
+    Bitset matches;
+    /// If the client is the compositor itself, which the defaults allow everything
+    bool is_self;
+    /// Read from /proc the first time a condition needs them, so policies that do not use them cost nothing
+    mutable std::optional<std::string> exe{};
+    mutable std::optional<std::string> cgroup{};
+    mutable std::optional<std::string> unit{};
+    mutable std::optional<std::string> app_id{};
+
+    auto get_exe() const -> std::string const& {
+        if (!exe) {
+            exe = read_exe(pid);
+        }
+        return exe.value();
+    }
+
+    auto get_cgroup() const -> std::string const& {
+        if (!cgroup) {
+            cgroup = read_cgroup(pid);
+        }
+        return cgroup.value();
+    }
+
+    auto get_unit() const -> std::string const& {
+        if (!unit) {
+            unit = unit_from_cgroup(get_cgroup());
+        }
+        return unit.value();
+    }
+
+    auto get_app_id() const -> std::string const& {
+        if (!app_id) {
+            app_id = read_app_id(pid);
+        }
+        return app_id.value();
+    }
+};
+
+/// The values are stored in compiled policies, so they must not be renumbered
+enum class Policy::Field : uint8_t {
+    pid = 0,
+    uid = 1,
+    gid = 2,
+    user = 3,
+    group = 4,
+    exe = 5,
+    cgroup = 6,
+    unit = 7,
+    app_id = 8,
+};
+
+struct Policy::Condition {
+    Field const field;
+    /// The values as written in the config file, kept so the policy can be compiled
+    std::vector<std::string> const sources;
+    /// Sorted, with variables resolved, for pid, uid and gid conditions
+    std::vector<uint32_t> const numbers;
+    /// Sorted, with variables resolved, for user and group conditions
+    std::vector<std::string> const names;
+
+    auto matches(Client const& client) const -> bool {
+        switch (field) {
+        case Field::pid: return std::binary_search(numbers.begin(), numbers.end(), static_cast<uint32_t>(client.pid));
+        case Field::uid: return std::binary_search(numbers.begin(), numbers.end(), client.uid);
+        case Field::gid: return std::binary_search(numbers.begin(), numbers.end(), client.gid);
+        case Field::user: return std::binary_search(names.begin(), names.end(), client.username);
+        case Field::group: return std::binary_search(names.begin(), names.end(), client.groupname);
+        case Field::exe: return std::binary_search(names.begin(), names.end(), client.get_exe());
+        case Field::cgroup: return std::binary_search(names.begin(), names.end(), client.get_cgroup());
+        case Field::unit: return std::binary_search(names.begin(), names.end(), client.get_unit());
+        case Field::app_id: return std::binary_search(names.begin(), names.end(), client.get_app_id());
+        }
+        return false;
+    }
 };
 
 struct Policy::Directive {
 public:
-    ConditionList const conditions;
+    std::vector<Condition> const conditions;
     bool const fallthrough;
     bool const enable;
-    std::set<std::string> const extensions;
+    Bitset const extensions;
 
-    auto check(Client const& client, std::string const& interface) -> std::optional<bool> {
-        auto const is_in_set = extensions.contains(interface);
-        // Do not return a value if the interface is not mentioned and this directive falls through
-        if (fallthrough && !is_in_set) {
-            return std::nullopt;
+    auto matches(Client const& client) const -> bool {
+        for (auto const& condition : conditions) {
+            if (!condition.matches(client)) {
+                return false;
+            }
         }
-        // Do not return a value if all the conditions do not match
+        return true;
+    }
+
+    /// If every client that matches other also matches this directive
+    auto implied_by(Directive const& other) const -> bool {
         for (auto const& condition : conditions) {
-            if (!condition(client)) {
-                return std::nullopt;
+            auto const stricter = std::find_if(other.conditions.begin(), other.conditions.end(), [&](auto const& c) {
+                return c.field == condition.field &&
+                    std::includes(
+                        condition.numbers.begin(), condition.numbers.end(), c.numbers.begin(), c.numbers.end()) &&
+                    std::includes(condition.names.begin(), condition.names.end(), c.names.begin(), c.names.end());
+            });
+            if (stricter == other.conditions.end()) {
+                return false;
             }
         }
-        return std::make_optional(enable == is_in_set);
+        return true;
     }
 };
 
+struct Policy::Fragment {
+    struct Directive {
+        bool enable;
+        bool fallthrough;
+        std::vector<std::string> interfaces;
+        std::vector<std::pair<Field, std::vector<std::string>>> conditions;
+    };
+
+    std::vector<Directive> directives;
+    std::array<std::optional<RateLimit>, rate_scopes> rate_limits;
+};
+
 Policy::Policy(const char* config_file) {
+    TRACE_PROBE1(policy__load__start, config_file ? config_file : "");
+    auto const start = std::chrono::steady_clock::now();
     load(config_file);
+    build_index();
+    load_time = std::chrono::steady_clock::now() - start;
+    TRACE_PROBE4(policy__load__end, filename.c_str(), loaded, directives.size(), load_time.count());
 }
 
 Policy::~Policy() {}
 
-auto Policy::client(wl_client* client) -> std::shared_ptr<Client> {
-    try {
-        pid_t pid;
-        uid_t uid;
-        gid_t gid;
-        wl_client_get_credentials(client, &pid, &uid, &gid);
-        auto const result = std::shared_ptr<Client>(new Client{
-            pid, uid, gid, get_username(uid), get_groupname(gid),
-        });
-        if (bouncer_debug) {
-            std::cerr << "wlbouncer: " << result->pid << " from " << result->username << " connected" << std::endl;
-        }
-        return result;
-    } catch (std::exception const& e) {
-        std::cerr << "wlbouncer: " << e.what() << std::endl;
+auto Policy::placeholder(bool allow_defaults) -> std::shared_ptr<Policy const> {
+    auto const policy = new Policy{};
+    policy->reset();
+    if (!allow_defaults) {
+        policy->defaults.clear();
+        policy->self_allowed = false;
+    }
+    policy->build_index();
+    return std::shared_ptr<Policy const>{policy};
+}
+
+auto Policy::ClassKey::Hash::operator()(ClassKey const& key) const -> size_t {
+    auto const hash = std::hash<uint64_t>{};
+    return hash((uint64_t{key.uid} << 32) | key.gid) ^ (hash(key.pid) << 1);
+}
+
+auto Policy::client(
+    pid_t pid,
+    uid_t uid,
+    gid_t gid,
+    std::string username,
+    std::string groupname
+) const -> std::shared_ptr<Client const> {
+    auto const result = std::make_shared<Client>(Client{
+        pid, uid, gid, std::move(username), std::move(groupname), Bitset{directives.size()}, self_allowed && pid == getpid(),
+    });
+    // Conditions only depend on the client, so they are evaluated once here instead of on every check()
+    for (size_t i = 0; i < directives.size(); i++) {
+        result->matches.set(i, directives[i].matches(*result));
+    }
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: " << result->pid << " from uid " << result->uid << " connected" << std::endl;
+    }
+    return result;
+}
+
+auto Policy::rebind(Client const& previous) const -> std::shared_ptr<Client const> {
+    // Names are never empty, so an empty one was not looked up
+    if ((tests_username && previous.username.empty()) || (tests_groupname && previous.groupname.empty())) {
         return nullptr;
     }
+    auto const result = std::make_shared<Client>(Client{
+        previous.pid,
+        previous.uid,
+        previous.gid,
+        previous.username,
+        previous.groupname,
+        Bitset{directives.size()},
+        self_allowed && previous.pid == getpid(),
+        previous.exe,
+        previous.cgroup,
+        previous.unit,
+        previous.app_id,
+    });
+    for (size_t i = 0; i < directives.size(); i++) {
+        result->matches.set(i, directives[i].matches(*result));
+    }
+    return result;
 }
 
-auto Policy::check(Client const& client, std::string const& interface) -> bool {
-    // Iterate through directives backwards because last one that returns a value is what we care about
-    std::optional<bool> result;
-    for (auto i = directives.rbegin(); i != directives.rend(); ++i ) {
-        result = i->check(client, interface);
-        if (result.has_value()) {
-            break;
+auto Policy::class_key(pid_t pid, uid_t uid, gid_t gid) const -> ClassKey {
+    return ClassKey{
+        tested_pids.contains(pid) ? pid : 0,
+        tests_uid ? uid : static_cast<uid_t>(-1),
+        tests_gid ? gid : static_cast<gid_t>(-1),
+    };
+}
+
+auto Policy::is_current() const -> bool {
+    return !filename.empty() && list_sources(filename) == sources;
+}
+
+auto Policy::check(Client const& client, InterfaceId interface) const -> bool {
+    auto const verdict = explain(client, interface);
+    trace_check(client, interface, verdict);
+    return verdict.allowed;
+}
+
+auto Policy::explain(Client const& client, InterfaceId interface) const -> Verdict {
+    // The last directive that applies to the interface and matches the client decides
+    auto const& candidates = interface < deciders.size() ? deciders[interface] : deciders.back();
+    if (auto const i = Bitset::last_common(candidates, client.matches)) {
+        auto const& interface_listed = interface < listed.size() ? listed[interface] : listed.back();
+        return {directives[i.value()].enable == interface_listed.test(i.value()), i};
+    } else {
+        return {defaults.test(interface) || client.is_self, std::nullopt};
+    }
+}
+
+void Policy::trace_check(
+    [[maybe_unused]] Client const& client,
+    [[maybe_unused]] InterfaceId interface,
+    [[maybe_unused]] Verdict const& verdict)
+{
+    TRACE_PROBE5(
+        policy__check,
+        client.pid,
+        client.uid,
+        interface,
+        verdict.allowed,
+        verdict.directive ? static_cast<int64_t>(verdict.directive.value()) : int64_t{-1});
+}
+
+auto Policy::deciders_for(InterfaceId interface) const -> Deciders {
+    auto const& candidates = interface < deciders.size() ? deciders[interface] : deciders.back();
+    auto const& interface_listed = interface < listed.size() ? listed[interface] : listed.back();
+    auto const words = (directives.size() + 63) / 64;
+    Deciders result{std::vector<uint64_t>(words, 0), std::vector<uint64_t>(words, 0), defaults.test(interface)};
+    auto const word = [](Bitset const& bits, size_t w) { return w < bits.data().size() ? bits.data()[w] : 0; };
+    for (size_t w = 0; w < words; w++) {
+        // A directive allows the interfaces it lists if it enables, and the ones it does not list if it disables
+        auto const allows = ~(word(enabling, w) ^ word(interface_listed, w));
+        result.allowing[w] = word(candidates, w) & allows;
+        result.denying[w] = word(candidates, w) & ~allows;
+    }
+    return result;
+}
+
+auto Policy::matches(Client const& client) -> Bitset const& {
+    return client.matches;
+}
+
+auto Policy::is_self(Client const& client) -> bool {
+    return client.is_self;
+}
+
+auto Policy::directive_count() const -> size_t {
+    return directives.size();
+}
+
+auto Policy::directive_matches(Client const& client, size_t directive) const -> bool {
+    return directives[directive].matches(client);
+}
+
+void Policy::forget_process_attributes(Client const& client) {
+    client.exe.reset();
+    client.cgroup.reset();
+    client.unit.reset();
+    client.app_id.reset();
+}
+
+auto Policy::shadowing_directive(size_t directive) const -> std::optional<size_t> {
+    auto const& shadowed = directives[directive];
+    for (auto i = directives.size(); i-- > directive + 1;) {
+        auto const& later = directives[i];
+        // The later directive must decide every interface the shadowed one does, for every client it matches
+        auto const covers_interfaces =
+            !later.fallthrough || (shadowed.fallthrough && shadowed.extensions.is_subset_of(later.extensions));
+        if (covers_interfaces && later.implied_by(shadowed)) {
+            return i;
         }
     }
-    if (result.has_value()) {
-        return result.value();
-    } else {
-        return default_extensions.contains(interface) || client.pid == getpid();
+    return std::nullopt;
+}
+
+auto Policy::describe_directive(size_t directive) const -> std::string {
+    auto const& d = directives[directive];
+    std::string result;
+    for (auto const& condition : d.conditions) {
+        static char const* const field_names[] = {"pid", "uid", "gid", "user", "group", "exe", "cgroup", "unit", "app-id"};
+        result += field_names[static_cast<size_t>(condition.field)];
+        result += condition.sources.size() == 1 ? ": " : "s: [";
+        for (size_t i = 0; i < condition.sources.size(); i++) {
+            result += (i ? ", " : "") + condition.sources[i];
+        }
+        result += condition.sources.size() == 1 ? ", " : "], ";
+    }
+    std::vector<std::string_view> names;
+    for (InterfaceId id = 0; id < interface_table.unknown(); id++) {
+        if (d.extensions.test(id)) {
+            names.push_back(interface_table.name(id));
+        }
+    }
+    if (!d.fallthrough && names.empty()) {
+        return result + (d.enable ? "disable: all" : "enable: all");
+    }
+    result += std::string{d.enable ? "enable" : "disable"} + (d.fallthrough ? "" : "-only") + ": [";
+    for (size_t i = 0; i < names.size(); i++) {
+        result += (i ? ", " : "") + std::string{names[i]};
     }
+    return result + "]";
 }
 
-namespace {
+auto Policy::unrecognized_interfaces() const -> std::vector<std::string_view> {
+    std::vector<std::string_view> result;
+    if (InterfaceTable::known_names().empty()) {
+        return result;
+    }
+    for (InterfaceId id = 0; id < config_interfaces; id++) {
+        auto const name = interface_table.name(id);
+        if (defaults.test(id) || InterfaceTable::is_known(name)) {
+            continue;
+        }
+        if (GlobSet::is_pattern(name)) {
+            GlobSet const pattern{std::vector<std::string_view>{name}};
+            auto const known = InterfaceTable::known_names();
+            if (std::any_of(known.begin(), known.end(), [&](auto known_name) {
+                return pattern.match(known_name) != GlobSet::no_match;
+            })) {
+                continue;
+            }
+        }
+        result.push_back(name);
+    }
+    return result;
+}
 
-auto find_config_file(const char* config_file) -> std::string {
-    if (config_file) {
-        if (std::filesystem::is_regular_file(config_file)) {
-            return config_file;
-        } else {
-            throw std::runtime_error{
-                std::string{config_file} + " is not a valid config path"};
+auto Policy::find_interface(std::string_view name) const -> InterfaceId {
+    auto const id = interface_table.find(name);
+    if (id != interface_table.unknown()) {
+        return id;
+    }
+    auto const set = patterns.match(name);
+    return set == GlobSet::no_match ? id : pattern_ids[set];
+}
+
+void Policy::compile_patterns() {
+    config_interfaces = interface_table.unknown();
+    std::vector<std::string_view> pattern_names;
+    std::vector<InterfaceId> pattern_name_ids;
+    for (InterfaceId id = 0; id < config_interfaces; id++) {
+        if (GlobSet::is_pattern(interface_table.name(id))) {
+            pattern_names.push_back(interface_table.name(id));
+            pattern_name_ids.push_back(id);
         }
     }
-    auto const path_from_env_raw = getenv("BOUNCER_CONFIG");
-    std::string path_from_env{path_from_env_raw ? path_from_env_raw : ""};
-    if (path_from_env.size()) {
-        if (std::filesystem::is_regular_file(path_from_env)) {
-            return path_from_env;
+    try {
+        patterns = pattern_names.empty() ? GlobSet{} : GlobSet{pattern_names};
+    } catch (std::exception& e) {
+        // Like any other error in the config file, this keeps a reloaded policy from replacing the current one
+        std::cerr << "wlbouncer: error loading " << filename << ": " << e.what() << std::endl;
+        loaded = false;
+        patterns = GlobSet{};
+    }
+    pattern_ids.clear();
+    for (auto const& set : patterns.match_sets()) {
+        if (set.size() == 1) {
+            // Names that match only this pattern are decided exactly like the pattern itself
+            pattern_ids.push_back(pattern_name_ids[set[0]]);
         } else {
-            throw std::runtime_error{
-                path_from_env + " from BOUNCER_CONFIG environment variable not a valid config path"};
+            std::string name;
+            for (auto const pattern : set) {
+                name += (name.empty() ? "" : "|") + std::string{pattern_names[pattern]};
+            }
+            pattern_ids.push_back(interface_table.intern(name));
         }
-    } else {
-        std::vector<std::string> search_paths{
-            "/usr/local/etc/wlbouncer.yaml",
-            "/etc/wlbouncer.yaml",
-        };
-        if (auto const home = getenv("HOME")) {
-            search_paths.push_back(std::string{home} + "/.config/wlbouncer.yaml");
+    }
+    // Every interface is listed by the directives that list it and the patterns matching it
+    listed.assign(interface_table.size(), Bitset{directives.size()});
+    auto const list_as = [&](InterfaceId id, InterfaceId source) {
+        for (size_t i = 0; i < directives.size(); i++) {
+            if (directives[i].extensions.test(source)) {
+                listed[id].set(i);
+            }
         }
-        for (auto const& path : search_paths) {
-            if (std::filesystem::is_regular_file(path)) {
-                return path;
+    };
+    for (InterfaceId id = 0; id < config_interfaces; id++) {
+        list_as(id, id);
+        auto const name = interface_table.name(id);
+        auto const set = GlobSet::is_pattern(name) ? GlobSet::no_match : patterns.match(name);
+        if (set != GlobSet::no_match) {
+            for (auto const pattern : patterns.match_sets()[set]) {
+                list_as(id, pattern_name_ids[pattern]);
+            }
+        }
+    }
+    for (size_t set = 0; set < pattern_ids.size(); set++) {
+        if (pattern_ids[set] >= config_interfaces) {
+            for (auto const pattern : patterns.match_sets()[set]) {
+                list_as(pattern_ids[set], pattern_name_ids[pattern]);
             }
         }
-        throw std::runtime_error{"could not find configuration file"};
     }
 }
 
+void Policy::build_index() {
+    compile_patterns();
+    Bitset all_interfaces{directives.size()};
+    for (size_t i = 0; i < directives.size(); i++) {
+        all_interfaces.set(i, !directives[i].fallthrough);
+    }
+    deciders.assign(interface_table.size(), all_interfaces);
+    enabling = Bitset{directives.size()};
+    for (size_t i = 0; i < directives.size(); i++) {
+        enabling.set(i, directives[i].enable);
+    }
+    for (size_t i = 0; i < directives.size(); i++) {
+        if (directives[i].fallthrough) {
+            // A fallthrough directive only decides for the interfaces it lists
+            for (InterfaceId id = 0; id < interface_table.unknown(); id++) {
+                if (listed[id].test(i)) {
+                    deciders[id].set(i);
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
 void parse_protocol_list(
     YAML::Node const& node,
     bool enable,
     bool only,
     bool* enable_out,
     bool* fallthrough_out,
-    std::set<std::string>* extensions_out,
+    std::vector<std::string>* interfaces_out,
     std::string* found_key_out
 ) {
     auto const key = std::string{enable ? "enable" : "disable"} + std::string{only ? "-only" : ""};
@@ -187,7 +533,7 @@ void parse_protocol_list(
                 *enable_out = !enable;
                 *fallthrough_out = false;
             } else {
-                extensions_out->insert(node[key].as<std::string>());
+                interfaces_out->push_back(node[key].as<std::string>());
             }
         } else if (node[key].IsSequence()) {
             for (auto const& extension : node[key]) {
@@ -195,7 +541,7 @@ void parse_protocol_list(
                     if (extension.as<std::string>() == "all") {
                         throw std::runtime_error{"'all' is only allowed when it is the only item"};
                     }
-                    extensions_out->insert(extension.as<std::string>());
+                    interfaces_out->push_back(extension.as<std::string>());
                 } else {
                     throw std::runtime_error{key + " list items should be strings"};
                 }
@@ -206,117 +552,511 @@ void parse_protocol_list(
     }
 }
 
-template<typename T>
-auto t_from_node(YAML::Node const& node, std::map<std::string, T> const& variables) -> T {
-    auto const var = variables.find(node.as<std::string>());
-    if (var == variables.end()) {
-        return node.as<T>();
-    } else {
-        return var->second;
-    }
-}
-
-template<typename T>
-void parse_condition(
-    YAML::Node const& node,
-    std::string const& name,
-    ConditionList* conditions_out,
-    std::function<T(Policy::Client const&)> get_item,
-    std::map<std::string, T> const& variables
-) {
+/// Returns the values of the singular or plural form of the condition, or nullopt if the directive has neither
+auto condition_sources(YAML::Node const& node, std::string const& name) -> std::optional<std::vector<std::string>> {
     auto const name_plural = name + "s";
     if (node[name]) {
         if (node[name_plural]) {
             throw std::runtime_error{"policy directive should not have both " + name + " and " + name_plural};
         }
         if (node[name].IsScalar()) {
-            T const item = t_from_node(node[name], variables);
-            conditions_out->push_back([=](auto client){
-               return item == get_item(client);
-            });
+            return std::vector<std::string>{node[name].as<std::string>()};
         } else {
             throw std::runtime_error{
                 name + " should have a single value, use " + name_plural + " for a list of " + name_plural};
         }
     } else if (node[name_plural]) {
         if (node[name_plural].IsSequence()) {
-            std::set<T> result;
+            std::vector<std::string> result;
             for (auto const& item : node[name_plural]) {
                 if (item.IsScalar()) {
-                    result.insert(t_from_node(item, variables));
+                    result.push_back(item.as<std::string>());
                 } else {
                     throw std::runtime_error{name_plural + " contains non-string value"};
                 }
             }
-            conditions_out->push_back([=](auto client){
-               return result.contains(get_item(client));
-            });
+            return result;
         } else {
             throw std::runtime_error{name_plural + " should be a list of values"};
         }
     }
+    return std::nullopt;
+}
+
+auto parse_number(std::string const& name, std::string const& source) -> uint32_t {
+    uint32_t result;
+    auto const [end, error] = std::from_chars(source.data(), source.data() + source.size(), result);
+    if (error != std::errc{} || end != source.data() + source.size()) {
+        throw std::runtime_error{"invalid " + name + " " + source};
+    }
+    return result;
+}
+
+/// Parses the rate-limit section, which maps each scope to its rate and optional burst
+void parse_rate_limits(
+    YAML::Node const& node,
+    std::array<std::optional<Policy::RateLimit>, Policy::rate_scopes>* limits_out
+) {
+    static std::pair<char const*, Policy::RateScope> const scopes[] = {
+        {"uid", Policy::RateScope::uid},
+        {"pid", Policy::RateScope::pid},
+        {"class", Policy::RateScope::client_class},
+    };
+    if (!node.IsMap()) {
+        throw std::runtime_error{"rate-limit should be a map of uid, pid or class to a limit"};
+    }
+    for (auto const& item : node) {
+        auto const key = item.first.as<std::string>();
+        auto const scope = std::find_if(std::begin(scopes), std::end(scopes), [&](auto const& scope) {
+            return key == scope.first;
+        });
+        if (scope == std::end(scopes)) {
+            throw std::runtime_error{"unknown rate-limit " + key + ", should be uid, pid or class"};
+        }
+        if (!item.second.IsMap() || !item.second["rate"]) {
+            throw std::runtime_error{"rate-limit " + key + " should contain a rate"};
+        }
+        auto const rate = item.second["rate"].as<double>();
+        auto const burst = item.second["burst"] ? item.second["burst"].as<double>() : rate;
+        if (!(rate > 0) || !(burst >= 1)) {
+            throw std::runtime_error{"rate-limit " + key + " needs a rate above 0 and a burst of at least 1"};
+        }
+        (*limits_out)[static_cast<size_t>(scope->second)] = Policy::RateLimit{rate, burst};
+    }
+}
+}
+
+auto Policy::make_condition(Field field, std::vector<std::string> sources) -> Condition {
+    std::vector<uint32_t> numbers;
+    std::vector<std::string> names;
+    for (auto const& source : sources) {
+        switch (field) {
+        case Field::pid:
+            numbers.push_back(
+                source == "$SELF_PID" ? getpid() :
+                source == "$PARENT_PID" ? getppid() :
+                parse_number("pid", source));
+            tested_pids.insert(numbers.back());
+            break;
+        case Field::uid:
+            numbers.push_back(
+                source == "$SELF_UID" ? getuid() :
+                source == "$SELF_EUID" ? geteuid() :
+                parse_number("uid", source));
+            tests_uid = true;
+            break;
+        case Field::gid:
+            numbers.push_back(
+                source == "$SELF_GID" ? getgid() :
+                source == "$SELF_EGID" ? getegid() :
+                parse_number("gid", source));
+            tests_gid = true;
+            break;
+        case Field::user:
+            names.push_back(
+                source == "$SELF_USER" ? get_username(getuid()) :
+                source == "$SELF_EUSER" ? get_username(geteuid()) :
+                source);
+            tests_uid = true;
+            tests_username = true;
+            break;
+        case Field::group:
+            names.push_back(
+                source == "$SERVER_GROUP" ? get_groupname(getgid()) :
+                source == "$SERVER_EGROUP" ? get_groupname(getegid()) :
+                source);
+            tests_gid = true;
+            tests_groupname = true;
+            break;
+        case Field::exe:
+            names.push_back(source == "$SELF_EXE" ? read_exe(getpid()) : source);
+            tests_process = true;
+            break;
+        case Field::cgroup:
+            names.push_back(source == "$SELF_CGROUP" ? read_cgroup(getpid()) : source);
+            tests_process = true;
+            break;
+        case Field::unit:
+            names.push_back(source == "$SELF_UNIT" ? unit_from_cgroup(read_cgroup(getpid())) : source);
+            tests_process = true;
+            break;
+        case Field::app_id:
+            names.push_back(source);
+            tests_process = true;
+            break;
+        default:
+            throw std::runtime_error{"unknown condition " + std::to_string(static_cast<int>(field))};
+        }
+    }
+    std::sort(numbers.begin(), numbers.end());
+    std::sort(names.begin(), names.end());
+    return Condition{field, std::move(sources), std::move(numbers), std::move(names)};
+}
+
+auto Policy::find_config_file(const char* config_file) -> std::string {
+    if (config_file) {
+        if (std::filesystem::is_regular_file(config_file)) {
+            return config_file;
+        } else {
+            throw std::runtime_error{
+                std::string{config_file} + " is not a valid config path"};
+        }
+    }
+    auto const path_from_env_raw = getenv("BOUNCER_CONFIG");
+    std::string path_from_env{path_from_env_raw ? path_from_env_raw : ""};
+    if (path_from_env.size()) {
+        if (std::filesystem::is_regular_file(path_from_env)) {
+            return path_from_env;
+        } else {
+            throw std::runtime_error{
+                path_from_env + " from BOUNCER_CONFIG environment variable not a valid config path"};
+        }
+    } else {
+        std::vector<std::string> search_paths{
+            "/usr/local/etc/wlbouncer.yaml",
+            "/etc/wlbouncer.yaml",
+        };
+        if (auto const home = getenv("HOME")) {
+            search_paths.push_back(std::string{home} + "/.config/wlbouncer.yaml");
+        }
+        for (auto const& path : search_paths) {
+            if (std::filesystem::is_regular_file(path)) {
+                return path;
+            }
+        }
+        throw std::runtime_error{"could not find configuration file"};
+    }
 }
+
+void Policy::reset() {
+    directives.clear();
+    interface_table.clear();
+    defaults.clear();
+    rate_limits = {};
+    compiled.reset();
+    // The defaults allow everything for the compositor's own clients
+    tested_pids = {getpid()};
+    tests_uid = false;
+    tests_gid = false;
+    tests_username = false;
+    tests_groupname = false;
+    tests_process = false;
+    for (size_t i = 0; i < default_extensions.size(); i++) {
+        auto const known = known_default_extensions[i];
+        defaults.set(known == known_interfaces::not_known
+            ? interface_table.intern(default_extensions[i])
+            : interface_table.intern_known(known));
+    }
+}
+
+void Policy::save_compiled(std::string const& path) const {
+    if (!loaded) {
+        throw std::runtime_error{"policy was not loaded"};
+    }
+    if (sources.size() > 1) {
+        throw std::runtime_error{"policies with drop-in fragments in " + dropin_path(filename) + " can not be compiled"};
+    }
+    CompiledPolicy file;
+    file.source_size = source_size;
+    file.source_mtime_ns = source_mtime_ns;
+    auto const checksum = source_checksum(filename);
+    // Checked after reading, so the checksum is of the contents that were loaded
+    if (!checksum || !is_current()) {
+        throw std::runtime_error{filename + " has changed since it was loaded"};
+    }
+    file.source_checksum = checksum.value();
+    // The IDs after config_interfaces are made up from the patterns again when the file is loaded
+    for (InterfaceId id = 0; id < config_interfaces; id++) {
+        file.names.push_back(interface_table.name(id));
+    }
+    for (auto const& directive : directives) {
+        auto& compiled_directive = file.directives.emplace_back(CompiledPolicy::Directive{
+            directive.enable, directive.fallthrough, directive.extensions.data(), {}});
+        for (auto const& condition : directive.conditions) {
+            compiled_directive.conditions.push_back(CompiledPolicy::Condition{
+                static_cast<uint8_t>(condition.field),
+                {condition.sources.begin(), condition.sources.end()}});
+        }
+    }
+    for (size_t scope = 0; scope < rate_scopes; scope++) {
+        if (auto const& limit = rate_limits[scope]) {
+            file.rate_limits.push_back({static_cast<uint8_t>(scope), limit->rate, limit->burst});
+        }
+    }
+    write_compiled_policy(file, path);
+}
+
+auto Policy::load_compiled(std::string const& path) -> bool {
+    std::shared_ptr<void const> mapping;
+    auto const file = read_compiled_policy(path, &mapping);
+    if (!file) {
+        return false;
+    }
+    if (file->source_size != source_size ||
+        file->source_mtime_ns != source_mtime_ns ||
+        source_checksum(filename) != file->source_checksum) {
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: ignoring " << path << ": " << filename << " has changed since it was compiled"
+                << std::endl;
+        }
+        return false;
+    }
+    try {
+        for (size_t i = 0; i < file->names.size(); i++) {
+            // The defaults are already interned, so this also checks they have not changed since the file was compiled
+            if (interface_table.intern_external(file->names[i]) != i) {
+                throw std::runtime_error{"compiled with different default interfaces"};
+            }
+        }
+        for (auto const& directive : file->directives) {
+            std::vector<Condition> conditions;
+            for (auto const& condition : directive.conditions) {
+                conditions.push_back(make_condition(
+                    static_cast<Field>(condition.field),
+                    {condition.values.begin(), condition.values.end()}));
+            }
+            directives.emplace_back(
+                std::move(conditions), directive.fallthrough, directive.enable, Bitset{directive.extensions});
+        }
+        for (auto const& limit : file->rate_limits) {
+            if (limit.scope >= rate_scopes) {
+                throw std::runtime_error{"unknown rate limit scope " + std::to_string(limit.scope)};
+            }
+            rate_limits[limit.scope] = RateLimit{limit.rate, limit.burst};
+        }
+    } catch (std::exception& e) {
+        std::cerr << "wlbouncer: ignoring " << path << ": " << e.what() << std::endl;
+        reset();
+        return false;
+    }
+    compiled = std::move(mapping);
+    return true;
+}
+
+auto Policy::dropin_path(std::string const& config_path) -> std::string {
+    return std::filesystem::path{config_path}.replace_extension(".d");
+}
+
+auto Policy::list_sources(std::string const& config_path) -> std::vector<SourceFile> {
+    auto const stamp = [](std::string path) -> std::optional<SourceFile> {
+        struct stat file_stat;
+        if (stat(path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            return std::nullopt;
+        }
+        return SourceFile{
+            std::move(path),
+            file_stat.st_ino,
+            static_cast<uint64_t>(file_stat.st_size),
+            int64_t{file_stat.st_mtim.tv_sec} * 1'000'000'000 + file_stat.st_mtim.tv_nsec,
+        };
+    };
+    std::vector<SourceFile> result;
+    if (auto config = stamp(config_path)) {
+        result.push_back(std::move(config.value()));
+    }
+    std::vector<std::string> fragments;
+    std::error_code error;
+    for (auto const& entry : std::filesystem::directory_iterator{dropin_path(config_path), error}) {
+        auto const name = entry.path().filename().string();
+        // Skips the hidden files editors write while saving
+        if (!name.starts_with(".") && entry.path().extension() == ".yaml") {
+            fragments.push_back(entry.path());
+        }
+    }
+    std::sort(fragments.begin(), fragments.end());
+    for (auto& fragment : fragments) {
+        if (auto source = stamp(std::move(fragment))) {
+            result.push_back(std::move(source.value()));
+        }
+    }
+    return result;
+}
+
+auto Policy::parse_fragment(std::string const& path, bool is_config) -> std::shared_ptr<Fragment const> {
+    static std::pair<char const*, Field> const condition_fields[] = {
+        {"pid", Field::pid},
+        {"uid", Field::uid},
+        {"gid", Field::gid},
+        {"user", Field::user},
+        {"group", Field::group},
+        // Conditions read from /proc last, so they are skipped when a cheaper condition already failed
+        {"exe", Field::exe},
+        {"cgroup", Field::cgroup},
+        {"unit", Field::unit},
+        {"app-id", Field::app_id},
+    };
+    auto fragment = std::make_shared<Fragment>();
+    YAML::Node root = YAML::LoadFile(path);
+    // Fragments may leave out the version, the config file they belong to has one
+    if ((is_config || root["version"]) && root["version"].as<int>() != 0) {
+        throw std::runtime_error{"invalid config file version"};
+    }
+    for (auto const& node : root["policy"]) {
+        auto& directive = fragment->directives.emplace_back();
+        std::string found_key;
+        auto const enable = &directive.enable;
+        auto const fallthrough = &directive.fallthrough;
+        auto const interfaces = &directive.interfaces;
+        parse_protocol_list(node, true, false, enable, fallthrough, interfaces, &found_key);
+        parse_protocol_list(node, false, false, enable, fallthrough, interfaces, &found_key);
+        parse_protocol_list(node, true, true, enable, fallthrough, interfaces, &found_key);
+        parse_protocol_list(node, false, true, enable, fallthrough, interfaces, &found_key);
+        if (found_key.empty()) {
+            throw std::runtime_error{"policy directive did not contain enable, enable-only, disable or disable-only"};
+        }
+        for (auto const& [name, field] : condition_fields) {
+            if (auto sources = condition_sources(node, name)) {
+                directive.conditions.emplace_back(field, std::move(sources.value()));
+            }
+        }
+    }
+    if (auto const node = root["rate-limit"]) {
+        parse_rate_limits(node, &fragment->rate_limits);
+    }
+    return fragment;
+}
+
+auto Policy::parse_sources(std::vector<SourceFile> const& files) -> std::vector<std::shared_ptr<Fragment const>> {
+    static std::mutex cache_mutex;
+    /// Every file parsed so far by path, with the version of it that was parsed
+    static std::unordered_map<std::string, std::pair<SourceFile, std::shared_ptr<Fragment const>>> cache;
+
+    std::vector<std::shared_ptr<Fragment const>> fragments(files.size());
+    std::vector<size_t> changed;
+    {
+        std::lock_guard lock{cache_mutex};
+        for (size_t i = 0; i < files.size(); i++) {
+            auto const iter = cache.find(files[i].path);
+            if (iter != cache.end() && iter->second.first == files[i]) {
+                fragments[i] = iter->second.second;
+            } else {
+                changed.push_back(i);
+            }
+        }
+    }
+    if (bouncer_debug && !files.empty()) {
+        std::cerr << "wlbouncer: parsing " << changed.size() << " of " << files.size() << " config files" << std::endl;
+    }
+
+    std::vector<std::exception_ptr> errors(files.size());
+    std::atomic<size_t> next{0};
+    auto const parse_changed = [&]() {
+        for (size_t j; (j = next.fetch_add(1, std::memory_order_relaxed)) < changed.size();) {
+            auto const i = changed[j];
+            try {
+                fragments[i] = parse_fragment(files[i].path, i == 0);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    // Only worth starting threads when there are several files to parse
+    auto const thread_count = std::min<size_t>(changed.size(), std::max(std::thread::hardware_concurrency(), 1u));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; t++) {
+        threads.emplace_back(parse_changed);
+    }
+    parse_changed();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    {
+        std::lock_guard lock{cache_mutex};
+        std::set<std::filesystem::path> directories;
+        std::set<std::string> paths;
+        for (size_t i = 0; i < files.size(); i++) {
+            directories.insert(std::filesystem::path{files[i].path}.parent_path());
+            paths.insert(files[i].path);
+            if (fragments[i]) {
+                cache[files[i].path] = {files[i], fragments[i]};
+            }
+        }
+        // Forgets fragments that were removed from the directories that were just listed
+        std::erase_if(cache, [&](auto const& entry) {
+            return !paths.contains(entry.first) &&
+                directories.contains(std::filesystem::path{entry.first}.parent_path());
+        });
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        try {
+            if (errors[i]) {
+                std::rethrow_exception(errors[i]);
+            }
+        } catch (std::exception& e) {
+            throw std::runtime_error{files[i].path + ": " + e.what()};
+        }
+    }
+    return fragments;
+}
+
+void Policy::add_fragment(Fragment const& fragment) {
+    for (auto const& directive : fragment.directives) {
+        Bitset extensions;
+        for (auto const& name : directive.interfaces) {
+            extensions.set(interface_table.intern(name));
+        }
+        std::vector<Condition> conditions;
+        for (auto const& [field, sources] : directive.conditions) {
+            conditions.push_back(make_condition(field, sources));
+        }
+        directives.emplace_back(std::move(conditions), directive.fallthrough, directive.enable, std::move(extensions));
+    }
+    for (size_t scope = 0; scope < rate_scopes; scope++) {
+        if (fragment.rate_limits[scope]) {
+            rate_limits[scope] = fragment.rate_limits[scope];
+        }
+    }
 }
 
 void Policy::load(const char* config_file)
 {
-    directives.clear();
-    std::string filename;
+    reset();
+    loaded = false;
     try {
         filename = find_config_file(config_file);
     } catch (std::exception& e) {
         std::cerr << "wlbouncer: " << e.what() << std::endl;
         return;
     }
+    sources = list_sources(filename);
+    source_size = 0;
+    source_mtime_ns = 0;
+    if (!sources.empty() && sources[0].path == filename) {
+        source_size = sources[0].size;
+        source_mtime_ns = sources[0].mtime_ns;
+    }
+    // A compiled policy only covers the config file, so it is not used while there are fragments
+    if (sources.size() <= 1 && load_compiled(compiled_path(filename))) {
+        loaded = true;
+        if (bouncer_debug) {
+            std::cerr << "wlbouncer: " << directives.size() << " policy directives loaded from "
+                << compiled_path(filename) << std::endl;
+        }
+        return;
+    }
     if (bouncer_debug) {
         std::cerr << "wlbouncer: " << "loading " << filename << std::endl;
     }
     try {
-        YAML::Node root = YAML::LoadFile(filename);
-        if (root["version"].as<int>() != 0) {
-            throw std::runtime_error{"invalid config file version"};
-        }
-        for (auto const& node : root["policy"]) {
-            bool enable = false;
-            bool fallthrough = false;
-            std::set<std::string> extensions;
-            std::string found_key;
-            parse_protocol_list(node, true, false, &enable, &fallthrough, &extensions, &found_key);
-            parse_protocol_list(node, false, false, &enable, &fallthrough, &extensions, &found_key);
-            parse_protocol_list(node, true, true, &enable, &fallthrough, &extensions, &found_key);
-            parse_protocol_list(node, false, true, &enable, &fallthrough, &extensions, &found_key);
-            if (found_key.empty()) {
-                throw std::runtime_error{
-                    "policy directive did not contain enable, enable-only, disable or disable-only"};
+        auto const fragments = parse_sources(sources);
+        for (size_t i = 0; i < fragments.size(); i++) {
+            try {
+                add_fragment(*fragments[i]);
+            } catch (std::exception& e) {
+                throw std::runtime_error{sources[i].path + ": " + e.what()};
             }
-            ConditionList conditions;
-            parse_condition<pid_t>(node, "pid", &conditions, [](auto client){ return client.pid; }, {
-                {"$SELF_PID", getpid()},
-                {"$PARENT_PID", getppid()},
-            });
-            parse_condition<uid_t>(node, "uid", &conditions, [](auto client){ return client.uid; }, {
-                {"$SELF_UID", getuid()},
-                {"$SELF_EUID", geteuid()},
-            });
-            parse_condition<gid_t>(node, "gid", &conditions, [](auto client){ return client.gid; }, {
-                {"$SELF_GID", getgid()},
-                {"$SELF_EGID", getegid()},
-            });
-            parse_condition<std::string>(node, "user", &conditions, [](auto client){ return client.username; }, {
-                {"$SELF_USER", get_username(getuid())},
-                {"$SELF_EUSER", get_username(geteuid())},
-            });
-            parse_condition<std::string>(node, "group", &conditions, [](auto client){ return client.groupname; }, {
-                {"$SERVER_GROUP", get_groupname(getgid())},
-                {"$SERVER_EGROUP", get_groupname(getegid())},
-            });
-            directives.emplace_back(conditions, fallthrough, enable, extensions);
         }
     } catch (std::exception& e) {
-        std::cerr << "wlbouncer: error loading " << filename << ": " << e.what() << std::endl;
+        std::cerr << "wlbouncer: error loading " << e.what() << std::endl;
         return;
     }
+    loaded = true;
     if (bouncer_debug) {
-        std::cerr << "wlbouncer: " << directives.size() << " policy directives loaded" << std::endl;
+        std::cerr << "wlbouncer: " << directives.size() << " policy directives loaded";
+        if (sources.size() > 1) {
+            std::cerr << " from " << sources.size() - 1 << " drop-in fragments and " << filename;
+        }
+        std::cerr << std::endl;
     }
 }
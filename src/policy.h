@@ -2,31 +2,214 @@
 #define WL_BOUNCER_POLICY_H
 
 #include <unistd.h>
+#include <array>
+#include <chrono>
 #include <string>
 #include <memory>
+#include <optional>
 #include <vector>
-
-struct wl_client;
+#include <set>
+#include "bitset.h"
+#include "glob_set.h"
+#include "interface_table.h"
 
 class Policy {
 public:
     struct Client;
 
+    /// Clients with equal keys get the same result from check() for every interface. Only the credentials that the
+    /// loaded directives test are part of the key.
+    struct ClassKey {
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+
+        auto operator==(ClassKey const&) const -> bool = default;
+
+        struct Hash {
+            auto operator()(ClassKey const& key) const -> size_t;
+        };
+    };
+
+    struct Verdict {
+        bool allowed;
+        /// The index of the directive that decided, or nullopt if none applied and the defaults decided
+        std::optional<size_t> directive;
+    };
+
+    /// What a connection rate limit counts connections by, the values are stored in compiled policies
+    enum class RateScope : uint8_t {
+        uid = 0,
+        pid = 1,
+        client_class = 2,
+    };
+    static constexpr size_t rate_scopes = 3;
+
+    /// Connections per second, and how many may arrive at once before that applies
+    struct RateLimit {
+        double rate;
+        double burst;
+
+        auto operator==(RateLimit const&) const -> bool = default;
+    };
+
     Policy(const char* config_file);
     ~Policy();
 
-    auto client(wl_client* client) -> std::shared_ptr<Client>;
-    auto check(Client const& client, std::string const& interface) -> bool;
+    /// A policy that loads nothing, for use until the real one is loaded. It allows the built-in defaults if
+    /// allow_defaults, otherwise it allows nothing at all.
+    static auto placeholder(bool allow_defaults) -> std::shared_ptr<Policy const>;
+
+    /// The names are only used if needs_username() and needs_groupname()
+    auto client(
+        pid_t pid,
+        uid_t uid,
+        gid_t gid,
+        std::string username,
+        std::string groupname) const -> std::shared_ptr<Client const>;
+    /// A client of this policy with the same credentials, names and process attributes as one made by another policy,
+    /// without looking any of them up again. Null if this policy tests a name the other one did not need.
+    auto rebind(Client const& previous) const -> std::shared_ptr<Client const>;
+    auto needs_username() const -> bool { return tests_username; }
+    auto needs_groupname() const -> bool { return tests_groupname; }
+    /// If directives test attributes of the client's process, which are not part of the class key so clients can
+    /// not share decisions
+    auto needs_process() const -> bool { return tests_process; }
+    auto class_key(pid_t pid, uid_t uid, gid_t gid) const -> ClassKey;
+    /// Fires the policy__check probe, which explain() leaves out so callers that only report a decision do not fire it
+    /// a second time
+    auto check(Client const& client, InterfaceId interface) const -> bool;
+    auto explain(Client const& client, InterfaceId interface) const -> Verdict;
+    /// Fires the policy__check probe for a decision made without check(), such as by a ClassTable
+    static void trace_check(Client const& client, InterfaceId interface, Verdict const& verdict);
+    /// What decides an interface, in a form that can be applied to many clients in one pass: a client is allowed if
+    /// the highest directive it matches in allowing is above the highest it matches in denying, and by the defaults if
+    /// it matches neither. Bit i of word i / 64 stands for directive i, as in matches().
+    struct Deciders {
+        std::vector<uint64_t> allowing;
+        std::vector<uint64_t> denying;
+        bool defaults_allow;
+    };
+    auto deciders_for(InterfaceId interface) const -> Deciders;
+    /// The directives whose conditions the client matches
+    static auto matches(Client const& client) -> Bitset const&;
+    /// If the defaults allow the client everything
+    static auto is_self(Client const& client) -> bool;
+    auto interfaces() const -> InterfaceTable const& { return interface_table; }
+    /// Returns the ID to check name with. Names the config file does not list get the ID shared by names matching the
+    /// same set of patterns, or interfaces().unknown() if they match none. Does not allocate.
+    auto find_interface(std::string_view name) const -> InterfaceId;
+    /// Nullopt if connections are not limited by scope
+    auto rate_limit(RateScope scope) const -> std::optional<RateLimit> const& {
+        return rate_limits[static_cast<size_t>(scope)];
+    }
+    /// The config file that was found, or empty if there was none
+    auto path() const -> std::string const& { return filename; }
+    /// If the config file was found and parsed without errors
+    auto ok() const -> bool { return loaded; }
+    /// If the config file has not changed since it was loaded
+    auto is_current() const -> bool;
+    auto load_duration() const -> std::chrono::nanoseconds { return load_time; }
+    /// For tools that inspect the policy, directives are numbered in the order they appear in the config file
+    auto directive_count() const -> size_t;
+    auto directive_matches(Client const& client, size_t directive) const -> bool;
+    /// Makes the next condition that needs the client's executable, cgroup, unit or app ID read it from /proc again, so
+    /// tools can time evaluating a directive for a new client
+    static void forget_process_attributes(Client const& client);
+    /// A later directive that overrides every decision this one could make, for every client this one matches
+    auto shadowing_directive(size_t directive) const -> std::optional<size_t>;
+    /// The directive in roughly the form it was written in the config file
+    auto describe_directive(size_t directive) const -> std::string;
+    /// Names and patterns in the config that match no interface in the protocols known at build time, likely typos.
+    /// Empty if no protocols were known at build time.
+    auto unrecognized_interfaces() const -> std::vector<std::string_view>;
+    /// Writes the policy in the compiled form that is loaded instead of the config file when it is up to date,
+    /// throws on failure
+    void save_compiled(std::string const& path) const;
+    /// Returns config_file if it exists, otherwise searches BOUNCER_CONFIG and the default paths, throws if none is
+    /// found
+    static auto find_config_file(const char* config_file) -> std::string;
+    /// Where the compiled form of a config file is looked for
+    static auto compiled_path(std::string const& config_path) -> std::string { return config_path + ".bin"; }
+    /// The directory whose *.yaml fragments are added to a config file, /etc/wlbouncer.d for /etc/wlbouncer.yaml
+    static auto dropin_path(std::string const& config_path) -> std::string;
 
 private:
+    Policy() = default;
     Policy(Policy const&) = delete;
     auto operator=(Policy const&) = delete;
 
+    struct Condition;
     struct Directive;
+    struct Fragment;
+    enum class Field : uint8_t;
+
+    /// Identifies a version of a file, a file whose stamp is unchanged is not parsed again
+    struct SourceFile {
+        std::string path;
+        uint64_t inode;
+        uint64_t size;
+        int64_t mtime_ns;
+
+        auto operator==(SourceFile const&) const -> bool = default;
+    };
 
+    std::string filename;
+    bool loaded = false;
+    /// The config file followed by its drop-in fragments in the order they apply
+    std::vector<SourceFile> sources;
+    /// The size and modification time of the config file when it was loaded, a compiled policy is only used if they
+    /// match
+    uint64_t source_size = 0;
+    int64_t source_mtime_ns = 0;
+    /// Keeps the compiled file mapped while the interface table refers to its names
+    std::shared_ptr<void const> compiled;
+    std::chrono::nanoseconds load_time{};
+    InterfaceTable interface_table;
     std::vector<Directive> directives;
+    Bitset defaults;
+    std::array<std::optional<RateLimit>, rate_scopes> rate_limits;
+    /// Names and patterns from the config file have IDs below this, the IDs after it stand for names that match
+    /// more than one pattern
+    InterfaceId config_interfaces = 0;
+    /// The patterns among the interface names, and for each of GlobSet::match_sets() the ID that stands for it
+    GlobSet patterns;
+    std::vector<InterfaceId> pattern_ids;
+    /// Indexed by InterfaceId, the directives that list that interface by name or by a pattern that matches it
+    std::vector<Bitset> listed;
+    /// Indexed by InterfaceId, the directives that decide for that interface if they match a client (the ones that
+    /// list it and the ones that do not fall through)
+    std::vector<Bitset> deciders;
+    /// The directives that enable rather than disable the interfaces they list
+    Bitset enabling;
+    /// The PIDs that any directive or the defaults compare against, all others are equivalent
+    std::set<pid_t> tested_pids;
+    bool tests_uid = false;
+    bool tests_gid = false;
+    bool tests_username = false;
+    bool tests_groupname = false;
+    bool tests_process = false;
+    /// If the compositor's own clients are allowed everything when no directive applies
+    bool self_allowed = true;
 
+    /// Empties the policy down to the defaults
+    void reset();
+    /// Compiles the patterns among the interface names and gives each set of them a name can match an ID
+    void compile_patterns();
     void load(const char* config_file);
+    void build_index();
+    /// Returns false if the file is missing, damaged or out of date
+    auto load_compiled(std::string const& path) -> bool;
+    /// Appends the directives of a fragment and lets its rate limits override earlier ones
+    void add_fragment(Fragment const& fragment);
+    /// The config file and the fragments in its drop-in directory, as they are now
+    static auto list_sources(std::string const& config_path) -> std::vector<SourceFile>;
+    /// Parses each file, in parallel, unless an unchanged version of it was parsed before. Throws if any file fails
+    /// to parse, naming it.
+    static auto parse_sources(std::vector<SourceFile> const& files) -> std::vector<std::shared_ptr<Fragment const>>;
+    static auto parse_fragment(std::string const& path, bool is_config) -> std::shared_ptr<Fragment const>;
+    /// Resolves the variables in the values and records what the condition tests
+    auto make_condition(Field field, std::vector<std::string> values) -> Condition;
 };
 
 #endif // WL_BOUNCER_POLICY_H
@@ -0,0 +1,30 @@
+#include "policy_cache.h"
+#include "policy.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace {
+std::mutex cache_mutex;
+/// Weak so a policy is freed once no display uses it
+std::unordered_map<std::string, std::weak_ptr<Policy const>> cache;
+}
+
+auto shared_policy(const char* config_file) -> std::shared_ptr<Policy const> {
+    std::string path;
+    try {
+        path = Policy::find_config_file(config_file);
+    } catch (std::exception&) {
+        // Not shared, Policy reports the error
+        return std::make_shared<Policy const>(config_file);
+    }
+    // Held while loading, so displays initializing at the same time parse the file once
+    std::lock_guard lock{cache_mutex};
+    auto& entry = cache[path];
+    auto policy = entry.lock();
+    if (!policy || !policy->ok() || !policy->is_current()) {
+        policy = std::make_shared<Policy const>(path.c_str());
+        entry = policy;
+    }
+    return policy;
+}
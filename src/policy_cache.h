@@ -0,0 +1,13 @@
+#ifndef WL_BOUNCER_POLICY_CACHE_H
+#define WL_BOUNCER_POLICY_CACHE_H
+
+#include <memory>
+
+class Policy;
+
+/// Returns the policy for config_file (or the config file found the same way Policy finds it if null). Every display
+/// in the process that uses the same file gets the same immutable policy, as long as the file has not changed since
+/// it was loaded.
+auto shared_policy(const char* config_file) -> std::shared_ptr<Policy const>;
+
+#endif // WL_BOUNCER_POLICY_CACHE_H
@@ -0,0 +1,70 @@
+#include "policy_loader.h"
+#include "policy.h"
+#include "policy_cache.h"
+#include <iostream>
+#include <optional>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+extern bool bouncer_debug;
+
+PolicyLoader::PolicyLoader(
+    wl_event_loop* loop,
+    char const* config_file,
+    std::function<void(std::shared_ptr<Policy const>)> on_loaded
+) :
+    on_loaded{std::move(on_loaded)}
+{
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        std::cerr << "wlbouncer: failed to create eventfd, loading policy synchronously" << std::endl;
+        this->on_loaded(shared_policy(config_file));
+        return;
+    }
+    // Searched for here rather than on the loader thread, since reading BOUNCER_CONFIG and HOME there would race with
+    // the compositor setting variables such as WAYLAND_DISPLAY
+    std::optional<std::string> path;
+    try {
+        path = Policy::find_config_file(config_file);
+    } catch (std::exception& e) {
+        std::cerr << "wlbouncer: " << e.what() << std::endl;
+    }
+    event_source = wl_event_loop_add_fd(loop, event_fd, WL_EVENT_READABLE, &handle_loaded, this);
+    loader = std::thread{[this, path = std::move(path)]() {
+        // A policy without a config file is what loading synchronously would have produced
+        loaded = path ? shared_policy(path->c_str()) : Policy::placeholder(true);
+        uint64_t const count = 1;
+        if (write(event_fd, &count, sizeof(count)) != sizeof(count)) {
+            std::cerr << "wlbouncer: failed to signal loaded policy" << std::endl;
+        }
+    }};
+}
+
+PolicyLoader::~PolicyLoader() {
+    if (event_source) {
+        wl_event_source_remove(event_source);
+    }
+    if (loader.joinable()) {
+        loader.join();
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+}
+
+auto PolicyLoader::handle_loaded(int fd, uint32_t, void* data) -> int {
+    auto const self = static_cast<PolicyLoader*>(data);
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    self->loader.join();
+    wl_event_source_remove(self->event_source);
+    self->event_source = nullptr;
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: background policy load finished" << std::endl;
+    }
+    self->on_loaded(std::move(self->loaded));
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef WL_BOUNCER_POLICY_LOADER_H
+#define WL_BOUNCER_POLICY_LOADER_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+class Policy;
+struct wl_event_loop;
+struct wl_event_source;
+
+/// Loads a policy once on a background thread so the compositor does not wait for it at startup. on_loaded is called
+/// from the event loop with the result, including a policy that failed to load, since that is what loading it
+/// synchronously would have produced.
+class PolicyLoader {
+public:
+    /// config_file may be null to search the default locations
+    PolicyLoader(
+        wl_event_loop* loop,
+        char const* config_file,
+        std::function<void(std::shared_ptr<Policy const>)> on_loaded);
+    ~PolicyLoader();
+
+private:
+    PolicyLoader(PolicyLoader const&) = delete;
+    auto operator=(PolicyLoader const&) = delete;
+
+    std::function<void(std::shared_ptr<Policy const>)> const on_loaded;
+    int event_fd = -1;
+    wl_event_source* event_source = nullptr;
+    std::thread loader;
+    /// Written by the loader thread before it signals event_fd, read only after joining it
+    std::shared_ptr<Policy const> loaded;
+
+    static auto handle_loaded(int fd, uint32_t mask, void* data) -> int;
+};
+
+#endif // WL_BOUNCER_POLICY_LOADER_H
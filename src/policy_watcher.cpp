@@ -0,0 +1,140 @@
+#include "policy_watcher.h"
+#include "policy.h"
+#include "policy_cache.h"
+#include <iostream>
+#include <filesystem>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+extern bool bouncer_debug;
+
+namespace {
+constexpr uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+}
+
+PolicyWatcher::PolicyWatcher(
+    wl_event_loop* loop,
+    std::string path,
+    std::function<void(std::shared_ptr<Policy const>)> on_loaded
+) :
+    path{std::move(path)},
+    file_name{std::filesystem::path{this->path}.filename()},
+    dropin_path{Policy::dropin_path(this->path)},
+    dropin_name{std::filesystem::path{dropin_path}.filename()},
+    on_loaded{std::move(on_loaded)}
+{
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd < 0 || event_fd < 0) {
+        std::cerr << "wlbouncer: failed to watch " << this->path << std::endl;
+        return;
+    }
+    // Watch the directory rather than the file, since editors often replace the file instead of writing to it
+    auto const dir = std::filesystem::path{this->path}.parent_path();
+    if (inotify_add_watch(inotify_fd, dir.empty() ? "." : dir.c_str(), watch_mask) < 0) {
+        std::cerr << "wlbouncer: failed to watch " << dir << std::endl;
+        return;
+    }
+    watch_dropin();
+    inotify_source = wl_event_loop_add_fd(loop, inotify_fd, WL_EVENT_READABLE, &handle_inotify, this);
+    event_source = wl_event_loop_add_fd(loop, event_fd, WL_EVENT_READABLE, &handle_loaded, this);
+}
+
+PolicyWatcher::~PolicyWatcher() {
+    if (inotify_source) {
+        wl_event_source_remove(inotify_source);
+    }
+    if (event_source) {
+        wl_event_source_remove(event_source);
+    }
+    if (loader.joinable()) {
+        loader.join();
+    }
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if (event_fd >= 0) {
+        close(event_fd);
+    }
+}
+
+auto PolicyWatcher::handle_inotify(int fd, uint32_t, void* data) -> int {
+    auto const self = static_cast<PolicyWatcher*>(data);
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (auto i = buffer; i < buffer + len;) {
+            auto const event = reinterpret_cast<inotify_event const*>(i);
+            if (event->wd == self->dropin_watch) {
+                changed = changed || (event->len && std::string_view{event->name}.ends_with(".yaml"));
+            } else if (event->len && self->file_name == event->name) {
+                changed = true;
+            } else if (event->len && self->dropin_name == event->name) {
+                // The drop-in directory was created, removed or replaced
+                self->watch_dropin();
+                changed = true;
+            }
+            i += sizeof(inotify_event) + event->len;
+        }
+    }
+    if (changed) {
+        if (self->loader.joinable()) {
+            self->reload_again = true;
+        } else {
+            self->start_loading();
+        }
+    }
+    return 0;
+}
+
+auto PolicyWatcher::handle_loaded(int fd, uint32_t, void* data) -> int {
+    auto const self = static_cast<PolicyWatcher*>(data);
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    self->loader.join();
+    std::shared_ptr<Policy const> policy;
+    {
+        std::lock_guard lock{self->pending_mutex};
+        policy = std::move(self->pending);
+    }
+    if (self->reload_again) {
+        self->reload_again = false;
+        self->start_loading();
+    }
+    if (policy) {
+        self->on_loaded(std::move(policy));
+    }
+    return 0;
+}
+
+void PolicyWatcher::watch_dropin() {
+    // Adding a watch for a directory that is already watched returns the same descriptor
+    dropin_watch = inotify_add_watch(inotify_fd, dropin_path.c_str(), watch_mask | IN_ONLYDIR);
+}
+
+void PolicyWatcher::start_loading() {
+    if (bouncer_debug) {
+        std::cerr << "wlbouncer: " << path << " changed, reloading" << std::endl;
+    }
+    loader = std::thread{[this]() {
+        // Other displays watching the same file may have loaded it already
+        auto policy = shared_policy(path.c_str());
+        {
+            std::lock_guard lock{pending_mutex};
+            if (policy->ok()) {
+                pending = std::move(policy);
+            } else {
+                std::cerr << "wlbouncer: keeping the previous policy" << std::endl;
+            }
+        }
+        uint64_t const count = 1;
+        if (write(event_fd, &count, sizeof(count)) != sizeof(count)) {
+            std::cerr << "wlbouncer: failed to signal reloaded policy" << std::endl;
+        }
+    }};
+}
@@ -0,0 +1,53 @@
+#ifndef WL_BOUNCER_POLICY_WATCHER_H
+#define WL_BOUNCER_POLICY_WATCHER_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Policy;
+struct wl_event_loop;
+struct wl_event_source;
+
+/// Watches a config file and its drop-in directory with inotify and reloads the policy on a background thread when
+/// either changes. on_loaded is called from the event loop with each new policy that loads without errors, so
+/// swapping it in needs no locking.
+class PolicyWatcher {
+public:
+    PolicyWatcher(
+        wl_event_loop* loop,
+        std::string path,
+        std::function<void(std::shared_ptr<Policy const>)> on_loaded);
+    ~PolicyWatcher();
+
+private:
+    PolicyWatcher(PolicyWatcher const&) = delete;
+    auto operator=(PolicyWatcher const&) = delete;
+
+    std::string const path;
+    std::string const file_name;
+    std::string const dropin_path;
+    std::string const dropin_name;
+    std::function<void(std::shared_ptr<Policy const>)> const on_loaded;
+    int inotify_fd = -1;
+    /// The watch on the drop-in directory, or -1 while it does not exist
+    int dropin_watch = -1;
+    int event_fd = -1;
+    wl_event_source* inotify_source = nullptr;
+    wl_event_source* event_source = nullptr;
+    std::thread loader;
+    /// Set if the file changed again while the loader was running
+    bool reload_again = false;
+
+    std::mutex pending_mutex;
+    std::shared_ptr<Policy const> pending;
+
+    static auto handle_inotify(int fd, uint32_t mask, void* data) -> int;
+    static auto handle_loaded(int fd, uint32_t mask, void* data) -> int;
+    void start_loading();
+    void watch_dropin();
+};
+
+#endif // WL_BOUNCER_POLICY_WATCHER_H
@@ -0,0 +1,70 @@
+#include "process_info.h"
+#include <climits>
+#include <fstream>
+
+namespace {
+auto proc_path(pid_t pid, char const* file) -> std::string {
+    return "/proc/" + std::to_string(pid) + "/" + file;
+}
+
+auto ends_with(std::string_view str, std::string_view suffix) -> bool {
+    return str.size() >= suffix.size() && str.substr(str.size() - suffix.size()) == suffix;
+}
+}
+
+auto read_exe(pid_t pid) -> std::string {
+    char buffer[PATH_MAX];
+    auto const length = readlink(proc_path(pid, "exe").c_str(), buffer, sizeof(buffer));
+    if (length <= 0 || static_cast<size_t>(length) >= sizeof(buffer)) {
+        return {};
+    }
+    std::string_view exe{buffer, static_cast<size_t>(length)};
+    constexpr std::string_view deleted = " (deleted)";
+    if (ends_with(exe, deleted)) {
+        exe.remove_suffix(deleted.size());
+    }
+    return std::string{exe};
+}
+
+auto read_cgroup(pid_t pid) -> std::string {
+    // Each line is hierarchy-ID:controller-list:path, the unified hierarchy has the ID 0 and no controllers
+    std::ifstream file{proc_path(pid, "cgroup")};
+    std::string systemd_path;
+    for (std::string line; std::getline(file, line);) {
+        if (line.starts_with("0::")) {
+            return line.substr(3);
+        }
+        auto const controllers = line.find(':');
+        if (controllers != std::string::npos && line.compare(controllers, 14, ":name=systemd:") == 0) {
+            systemd_path = line.substr(controllers + 14);
+        }
+    }
+    return systemd_path;
+}
+
+auto read_app_id(pid_t pid) -> std::string {
+    // Flatpak puts this file at the root of every sandbox, it is read through the process's root so the path is
+    // resolved inside the sandbox
+    std::ifstream file{proc_path(pid, "root/.flatpak-info")};
+    bool in_application = false;
+    for (std::string line; std::getline(file, line);) {
+        if (line.starts_with("[")) {
+            in_application = line == "[Application]";
+        } else if (in_application && line.starts_with("name=")) {
+            return line.substr(5);
+        }
+    }
+    return {};
+}
+
+auto unit_from_cgroup(std::string_view cgroup) -> std::string {
+    while (!cgroup.empty()) {
+        auto const slash = cgroup.rfind('/');
+        auto const component = cgroup.substr(slash == std::string_view::npos ? 0 : slash + 1);
+        if (ends_with(component, ".service") || ends_with(component, ".scope")) {
+            return std::string{component};
+        }
+        cgroup = cgroup.substr(0, slash == std::string_view::npos ? 0 : slash);
+    }
+    return {};
+}
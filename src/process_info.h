@@ -0,0 +1,21 @@
+#ifndef WL_BOUNCER_PROCESS_INFO_H
+#define WL_BOUNCER_PROCESS_INFO_H
+
+#include <unistd.h>
+#include <string>
+#include <string_view>
+
+/// Attributes of a process read from /proc, each returns an empty string if it can not be determined
+
+/// The path of the process's executable, without the " (deleted)" the kernel appends once the file is unlinked, as
+/// package upgrades do for every running program they replace
+auto read_exe(pid_t pid) -> std::string;
+/// The process's cgroup v2 path (or the systemd hierarchy's path on cgroup v1 systems)
+auto read_cgroup(pid_t pid) -> std::string;
+/// The Flatpak application ID of a sandboxed process
+auto read_app_id(pid_t pid) -> std::string;
+
+/// The innermost systemd service or scope in a cgroup path, such as app-org.gnome.Terminal-1234.scope
+auto unit_from_cgroup(std::string_view cgroup) -> std::string;
+
+#endif // WL_BOUNCER_PROCESS_INFO_H
@@ -0,0 +1,34 @@
+#include "rate_limiter.h"
+#include <algorithm>
+
+RateLimiter::RateLimiter(double rate, double burst) : rate_{rate}, burst_{burst} {}
+
+auto RateLimiter::take(uint64_t key, std::chrono::steady_clock::time_point now) -> bool {
+    // Never zero, so it can not be mistaken for an unused bucket
+    auto const now_ns = std::max<int64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count(), 1);
+    // Fibonacci hashing spreads sequential pids and uids over the sets
+    auto const set = &buckets[((key * 0x9e3779b97f4a7c15) >> 56) % sets * ways];
+    auto bucket = set;
+    for (size_t i = 0; i < ways; i++) {
+        if (set[i].updated_ns && set[i].key == key) {
+            bucket = &set[i];
+            break;
+        }
+        if (set[i].updated_ns < bucket->updated_ns) {
+            bucket = &set[i];
+        }
+    }
+    if (!bucket->updated_ns || bucket->key != key) {
+        *bucket = {key, now_ns, burst_};
+    } else {
+        auto const elapsed = static_cast<double>(now_ns - bucket->updated_ns) / 1e9;
+        bucket->tokens = std::min(burst_, bucket->tokens + elapsed * rate_);
+        bucket->updated_ns = now_ns;
+    }
+    if (bucket->tokens < 1) {
+        return false;
+    }
+    bucket->tokens -= 1;
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef WL_BOUNCER_RATE_LIMITER_H
+#define WL_BOUNCER_RATE_LIMITER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/// Token buckets for connections, one per key, in a fixed-size table so a flood of connections costs no allocation.
+/// Each bucket holds up to burst tokens and refills at rate tokens per second. When a key's set of the table is full
+/// the bucket that was used longest ago is evicted, which at worst hands its key a full bucket again. Not thread safe.
+class RateLimiter {
+public:
+    RateLimiter(double rate, double burst);
+
+    /// Takes a token from key's bucket, returns false if it was empty
+    auto take(uint64_t key, std::chrono::steady_clock::time_point now) -> bool;
+
+    auto rate() const -> double { return rate_; }
+    auto burst() const -> double { return burst_; }
+
+private:
+    static constexpr size_t sets = 256;
+    static constexpr size_t ways = 4;
+
+    struct Bucket {
+        uint64_t key;
+        /// Zero if the bucket is unused
+        int64_t updated_ns;
+        double tokens;
+    };
+
+    double const rate_;
+    double const burst_;
+    std::array<Bucket, sets * ways> buckets{};
+};
+
+#endif // WL_BOUNCER_RATE_LIMITER_H
@@ -0,0 +1,49 @@
+#ifndef WL_BOUNCER_RING_BUFFER_H
+#define WL_BOUNCER_RING_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+/// A fixed-size lock-free queue for exactly one producer thread and one consumer thread. The producer never blocks or
+/// allocates, a push onto a full buffer fails instead.
+template<typename T, size_t capacity>
+class RingBuffer {
+public:
+    static_assert(std::has_single_bit(capacity), "capacity must be a power of two");
+
+    /// Producer only, returns false if the buffer is full
+    auto push(T const& item) -> bool {
+        auto const current_head = head.load(std::memory_order_relaxed);
+        if (current_head - cached_tail == capacity) {
+            // Only look at the consumer's cache line when the buffer seems full
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (current_head - cached_tail == capacity) {
+                return false;
+            }
+        }
+        items[current_head & (capacity - 1)] = item;
+        head.store(current_head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Consumer only, returns false if the buffer is empty
+    auto pop(T* item) -> bool {
+        auto const current_tail = tail.load(std::memory_order_relaxed);
+        if (current_tail == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = items[current_tail & (capacity - 1)];
+        tail.store(current_tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    size_t cached_tail = 0;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::array<T, capacity> items;
+};
+
+#endif // WL_BOUNCER_RING_BUFFER_H
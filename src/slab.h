@@ -0,0 +1,69 @@
+#ifndef WL_BOUNCER_SLAB_H
+#define WL_BOUNCER_SLAB_H
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/// Allocates objects of one type from cache-line-aligned chunks and recycles them through a free list, so objects
+/// that come and go in bursts neither hit the heap nor fragment it. Chunks are kept until the slab is destroyed, at
+/// which point every object must already have been destroyed. Not thread safe.
+template<typename T, size_t chunk_size = 64>
+class Slab {
+public:
+    Slab() = default;
+
+    ~Slab() {
+        for (auto const chunk : chunks) {
+            ::operator delete(chunk, std::align_val_t{alignment});
+        }
+    }
+
+    template<typename... Args>
+    auto create(Args&&... args) -> T* {
+        if (!free_list) {
+            grow();
+        }
+        auto const slot = free_list;
+        free_list = slot->next;
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* item) {
+        item->~T();
+        auto const slot = reinterpret_cast<Slot*>(item);
+        slot->next = free_list;
+        free_list = slot;
+    }
+
+    /// The number of objects that fit in the chunks allocated so far
+    auto capacity() const -> size_t { return chunks.size() * chunk_size; }
+
+private:
+    Slab(Slab const&) = delete;
+    auto operator=(Slab const&) = delete;
+
+    static constexpr size_t alignment = std::max(alignof(T), size_t{64});
+
+    union Slot {
+        Slot* next;
+        alignas(alignment) unsigned char storage[sizeof(T)];
+    };
+
+    void grow() {
+        auto const chunk = static_cast<Slot*>(
+            ::operator new(sizeof(Slot) * chunk_size, std::align_val_t{alignment}));
+        chunks.push_back(chunk);
+        for (size_t i = chunk_size; i > 0; i--) {
+            chunk[i - 1].next = free_list;
+            free_list = &chunk[i - 1];
+        }
+    }
+
+    std::vector<Slot*> chunks;
+    Slot* free_list = nullptr;
+};
+
+#endif // WL_BOUNCER_SLAB_H
@@ -0,0 +1,23 @@
+#include "stats.h"
+#include "wlbouncer.h"
+
+static_assert(Histogram::buckets == WL_BOUNCER_HISTOGRAM_BUCKETS);
+
+void Stats::copy_to(wl_bouncer_stats* out) const {
+    *out = {};
+    out->struct_size = sizeof(*out);
+    out->filter_calls = filter_calls.load(std::memory_order_relaxed);
+    out->cache_hits = cache_hits.load(std::memory_order_relaxed);
+    out->cache_misses = cache_misses.load(std::memory_order_relaxed);
+    out->allowed = allowed.load(std::memory_order_relaxed);
+    out->denied = denied.load(std::memory_order_relaxed);
+    out->chained_filter_calls = chained_filter_calls.load(std::memory_order_relaxed);
+    out->queries = queries.load(std::memory_order_relaxed);
+    out->clients_created = clients_created.load(std::memory_order_relaxed);
+    out->clients_destroyed = clients_destroyed.load(std::memory_order_relaxed);
+    out->clients_rejected = clients_rejected.load(std::memory_order_relaxed);
+    out->policy_loads = policy_loads.load(std::memory_order_relaxed);
+    out->policy_load_ns = policy_load_ns.load(std::memory_order_relaxed);
+    filter_latency.copy_to(out->filter_latency);
+    client_created_latency.copy_to(out->client_created_latency);
+}
@@ -0,0 +1,62 @@
+#ifndef WL_BOUNCER_STATS_H
+#define WL_BOUNCER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+struct wl_bouncer_stats;
+
+/// For counters only written from one thread, avoids the locked instruction a fetch_add would need while still
+/// letting other threads read them
+inline void bump(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/// Counts durations in power-of-two nanosecond buckets
+class Histogram {
+public:
+    static constexpr size_t buckets = 32;
+
+    void record(std::chrono::steady_clock::duration duration) {
+        auto const ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+        auto const bucket = ns ? std::min<size_t>(std::bit_width(ns) - 1, buckets - 1) : 0;
+        bump(counts[bucket]);
+    }
+
+    void copy_to(uint64_t* out) const {
+        for (size_t i = 0; i < buckets; i++) {
+            out[i] = counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, buckets> counts{};
+};
+
+/// Per-display counters, written from the display's thread and readable from any thread
+struct Stats {
+    /// Only every filter_sample_interval'th filter call is timed, so reading the clock does not double its cost
+    static constexpr uint64_t filter_sample_interval = 64;
+
+    std::atomic<uint64_t> filter_calls{0};
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+    std::atomic<uint64_t> allowed{0};
+    std::atomic<uint64_t> denied{0};
+    std::atomic<uint64_t> chained_filter_calls{0};
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> clients_created{0};
+    std::atomic<uint64_t> clients_destroyed{0};
+    std::atomic<uint64_t> clients_rejected{0};
+    std::atomic<uint64_t> policy_loads{0};
+    std::atomic<uint64_t> policy_load_ns{0};
+    Histogram filter_latency;
+    Histogram client_created_latency;
+
+    void copy_to(wl_bouncer_stats* out) const;
+};
+
+#endif // WL_BOUNCER_STATS_H
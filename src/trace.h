@@ -0,0 +1,24 @@
+#ifndef WL_BOUNCER_TRACE_H
+#define WL_BOUNCER_TRACE_H
+
+/// USDT probes in the wlbouncer provider, for bpftrace, perf and other tracers that read the .note.stapsdt section.
+/// They are only compiled in when sys/sdt.h was found at configure time (see the tracing meson option). Each one is a
+/// single nop until a tracer attaches, so their arguments should be values the surrounding code already has at hand.
+/// The probes and their arguments are listed in README.md.
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE1(name, a) DTRACE_PROBE1(wlbouncer, name, a)
+#define TRACE_PROBE2(name, a, b) DTRACE_PROBE2(wlbouncer, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) DTRACE_PROBE3(wlbouncer, name, a, b, c)
+#define TRACE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(wlbouncer, name, a, b, c, d)
+#define TRACE_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(wlbouncer, name, a, b, c, d, e)
+#else
+#define TRACE_PROBE1(name, a) do {} while (0)
+#define TRACE_PROBE2(name, a, b) do {} while (0)
+#define TRACE_PROBE3(name, a, b, c) do {} while (0)
+#define TRACE_PROBE4(name, a, b, c, d) do {} while (0)
+#define TRACE_PROBE5(name, a, b, c, d, e) do {} while (0)
+#endif
+
+#endif // WL_BOUNCER_TRACE_H
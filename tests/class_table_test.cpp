@@ -0,0 +1,172 @@
+#include "class_table.h"
+#include "policy.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Checks that ClassTable::decide_all() gives every class the same Verdict as Policy::explain(), for every interface
+// ID of hand-written and generated policies. Runs with meson test.
+
+namespace {
+
+int failures = 0;
+
+struct Row {
+    std::shared_ptr<Policy::Client const> client;
+    std::string label;
+    size_t table_row;
+};
+
+auto describe(Policy::Verdict const& verdict) -> std::string {
+    return std::string{verdict.allowed ? "allowed" : "denied"} + " by "
+        + (verdict.directive ? "directive " + std::to_string(verdict.directive.value()) : "the defaults");
+}
+
+/// Decides every interface ID of the policy for all rows at once and compares with explain()
+void check_table(Policy const& policy, ClassTable<Row>& table, std::vector<Row*> const& rows, char const* what) {
+    size_t decided = 0;
+    for (InterfaceId id = 0; id < policy.interfaces().size(); id++) {
+        table.decide_all(policy.deciders_for(id), [&](Row* row, Policy::Verdict const& verdict) {
+            decided++;
+            auto const expected = policy.explain(*row->client, id);
+            if (verdict.allowed != expected.allowed || verdict.directive != expected.directive) {
+                fprintf(stderr, "FAIL: %s: interface %u for %s: %s, explain() says %s\n",
+                    what, id, row->label.c_str(), describe(verdict).c_str(), describe(expected).c_str());
+                failures++;
+            }
+        });
+    }
+    if (decided != policy.interfaces().size() * rows.size()) {
+        fprintf(stderr, "FAIL: %s: %zu decisions for %zu rows\n", what, decided, rows.size());
+        failures++;
+    }
+}
+
+auto write_config(std::string const& name, std::string const& contents) -> std::filesystem::path {
+    auto const path = std::filesystem::temp_directory_path()
+        / ("wlbouncer-class-table-test-" + std::to_string(getpid()) + "-" + name + ".yaml");
+    std::ofstream{path} << contents;
+    return path;
+}
+
+/// Every row of the policy's table, including the compositor itself, then again after removing some of them
+void check_policy(std::string const& name, std::string const& contents) {
+    auto const path = write_config(name, contents);
+    Policy const policy{path.c_str()};
+    std::filesystem::remove(path);
+    if (!policy.ok()) {
+        fprintf(stderr, "FAIL: %s: policy does not load\n", name.c_str());
+        failures++;
+        return;
+    }
+    std::vector<Row> rows;
+    auto const add = [&](pid_t pid, uid_t uid, gid_t gid, std::string user, std::string group) {
+        auto const label = "pid " + std::to_string(pid) + " uid " + std::to_string(uid) + " gid "
+            + std::to_string(gid) + " " + user + ":" + group;
+        rows.push_back({policy.client(pid, uid, gid, std::move(user), std::move(group)), label, 0});
+    };
+    add(getpid(), getuid(), getgid(), "root", "root");
+    for (uid_t uid = 1000; uid < 1024; uid++) {
+        add(static_cast<pid_t>(50000 + uid), uid, uid % 3 ? uid : 100, uid % 2 ? "alice" : "bob", "users");
+    }
+    add(1, 0, 0, "root", "root");
+    add(2, 65534, 65534, "nobody", "nogroup");
+
+    ClassTable<Row> table{policy.directive_count()};
+    std::vector<Row*> owners;
+    for (auto& row : rows) {
+        table.add(&row, *row.client);
+        owners.push_back(&row);
+    }
+    check_table(policy, table, owners, name.c_str());
+
+    // Removing rows moves the last one into their place
+    for (size_t i = 1; i < rows.size(); i += 3) {
+        table.remove(&rows[i]);
+        std::erase(owners, &rows[i]);
+    }
+    check_table(policy, table, owners, (name + " after removals").c_str());
+}
+
+/// Fall-through directives spread over several words, each either enabling or disabling a few names and patterns
+auto generated_config(unsigned seed, int directives) -> std::string {
+    static char const* const names[] = {
+        "wl_shm", "wl_seat", "wl_output", "zwlr_layer_shell_v1", "zwlr_screencopy_manager_v1",
+        "zwp_primary_selection_device_manager_v1", "ext_foreign_toplevel_list_v1", "xdg_foo", "zwlr_*", "*_manager_v1",
+        "ext_*_v?", "*",
+    };
+    static char const* const actions[] = {"enable", "disable", "enable-only", "disable-only"};
+    std::mt19937 rng{seed};
+    std::string config = "version: 0\npolicy:\n";
+    for (int i = 0; i < directives; i++) {
+        auto const roll = rng() % 6;
+        if (roll == 0) {
+            config += "  - uid: " + std::to_string(1000 + rng() % 24) + "\n";
+        } else if (roll == 1) {
+            config += "  - gid: 100\n";
+        } else if (roll == 2) {
+            config += "  - users: [alice, nobody]\n";
+        } else if (roll == 3) {
+            config += "  - groups: [users]\n    uids: [1001, 1003, 1005, 1007]\n";
+        } else if (roll == 4) {
+            config += "  - uid: 4000\n";
+        } else {
+            config += "  -\n";
+        }
+        config += std::string{"    "} + actions[rng() % 4] + ":\n";
+        for (auto count = 1 + rng() % 3; count > 0; count--) {
+            config += std::string{"      - \""} + names[rng() % std::size(names)] + "\"\n";
+        }
+    }
+    return config;
+}
+
+}
+
+auto main() -> int {
+    check_policy("defaults", "version: 0\npolicy: []\n");
+    check_policy("ordering",
+        "version: 0\n"
+        "policy:\n"
+        "  - enable: [zwlr_layer_shell_v1]\n"
+        "  - uid: 1001\n"
+        "    disable: [zwlr_layer_shell_v1]\n"
+        "  - users: [alice]\n"
+        "    enable-only: [wl_seat]\n"
+        "  - uid: 1003\n"
+        "    disable-only: [wl_shm]\n"
+        "  - gid: 100\n"
+        "    enable: [\"zwlr_*\"]\n"
+        "  - disable: [\"*_manager_v1\"]\n"
+        "  - users: [nobody]\n"
+        "    enable: [zwlr_screencopy_manager_v1]\n");
+    check_policy("patterns",
+        "version: 0\n"
+        "policy:\n"
+        "  - disable: all\n"
+        "  - enable: [\"zwlr_*\"]\n"
+        "  - uid: 1002\n"
+        "    disable: [\"*_manager_v?\"]\n"
+        "  - disable: [zwlr_layer_shell_v1]\n"
+        "  - users: [bob]\n"
+        "    enable: [zwlr_layer_shell_v1, \"ext_*\"]\n");
+    // One word, a word boundary, and several words of directives
+    for (auto const directives : {10, 64, 65, 200}) {
+        for (unsigned seed = 1; seed <= 5; seed++) {
+            check_policy(
+                "generated-" + std::to_string(directives) + "-" + std::to_string(seed),
+                generated_config(seed * 7919 + directives, directives));
+        }
+    }
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
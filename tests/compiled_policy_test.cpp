@@ -0,0 +1,204 @@
+#include "compiled_policy.h"
+#include "policy.h"
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Checks that a policy loaded from its compiled file decides like the config file it was compiled from, and that
+// compiled files of another format version, truncated, corrupted or compiled from other contents are ignored in
+// favor of the config file. Runs with meson test.
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, char const* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+auto const dir = std::filesystem::temp_directory_path()
+    / ("wlbouncer-compiled-policy-test-" + std::to_string(getpid()));
+
+auto const config_contents =
+    "version: 0\n"
+    "policy:\n"
+    "  - uid: 1001\n"
+    "    disable: [wl_shm]\n"
+    "  - enable: [\"zwlr_*\"]\n"
+    "  - users: [alice]\n"
+    "    enable-only: [wl_seat]\n"
+    "  - exe: /usr/bin/grim\n"
+    "    enable: [zwlr_screencopy_manager_v1]\n"
+    "rate-limit:\n"
+    "  uid: {rate: 20, burst: 50}\n"
+    "  pid: {rate: 5}\n";
+/// Allows uid 1001 to use wl_shm, unlike config_contents
+auto const other_contents =
+    "version: 0\n"
+    "policy:\n"
+    "  - uid: 1003\n"
+    "    disable: [wl_shm]\n"
+    "  - enable: [\"zwlr_*\"]\n"
+    "  - users: [alice]\n"
+    "    enable-only: [wl_seat]\n"
+    "  - exe: /usr/bin/grim\n"
+    "    enable: [zwlr_screencopy_manager_v1]\n"
+    "rate-limit:\n"
+    "  uid: {rate: 20, burst: 50}\n"
+    "  pid: {rate: 5}\n";
+
+auto const names = {
+    "wl_compositor", "wl_shm", "wl_seat", "wl_output", "zwlr_layer_shell_v1", "zwlr_screencopy_manager_v1",
+    "ext_foreign_toplevel_list_v1", "xdg_foo",
+};
+
+/// Fails if the two policies decide anything differently
+void check_same(Policy const& expected, Policy const& actual, char const* what) {
+    auto const same_client = [&](pid_t pid, uid_t uid, std::string user) {
+        auto const expected_client = expected.client(pid, uid, uid, user, user);
+        auto const actual_client = actual.client(pid, uid, uid, user, user);
+        for (auto const name : names) {
+            auto const a = expected.explain(*expected_client, expected.find_interface(name));
+            auto const b = actual.explain(*actual_client, actual.find_interface(name));
+            if (a.allowed != b.allowed || a.directive != b.directive) {
+                return false;
+            }
+        }
+        return true;
+    };
+    check(expected.ok() && actual.ok(), what);
+    check(same_client(getpid(), getuid(), "root"), what);
+    check(same_client(50000, 1000, "bob"), what);
+    check(same_client(50001, 1001, "carol"), what);
+    check(same_client(50002, 1002, "alice"), what);
+    check(expected.directive_count() == actual.directive_count(), what);
+    for (size_t i = 0; i < expected.directive_count() && i < actual.directive_count(); i++) {
+        check(expected.describe_directive(i) == actual.describe_directive(i), what);
+    }
+    for (auto const scope : {Policy::RateScope::uid, Policy::RateScope::pid, Policy::RateScope::client_class}) {
+        check(expected.rate_limit(scope) == actual.rate_limit(scope), what);
+    }
+}
+
+/// If uid 1001 may use wl_shm, which config_contents denies and other_contents allows
+auto allows_1001(Policy const& policy) -> bool {
+    auto const client = policy.client(50001, 1001, 1001, "carol", "carol");
+    return policy.explain(*client, policy.find_interface("wl_shm")).allowed;
+}
+
+void write_file(std::filesystem::path const& path, std::string const& contents) {
+    std::ofstream{path, std::ios::binary | std::ios::trunc} << contents;
+}
+
+auto read_file(std::filesystem::path const& path) -> std::string {
+    std::ifstream file{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+void test_round_trip(std::string const& config) {
+    write_file(config, config_contents);
+    Policy const parsed{config.c_str()};
+    parsed.save_compiled(Policy::compiled_path(config));
+    std::shared_ptr<void const> mapping;
+    auto const file = read_compiled_policy(Policy::compiled_path(config), &mapping);
+    check(file.has_value(), "compiled file can be read");
+    if (file) {
+        check(file->directives.size() == 4, "directives are compiled");
+        check(file->rate_limits.size() == 2, "rate limits are compiled");
+        check(file->source_checksum == source_checksum(config), "source checksum is recorded");
+    }
+    Policy const loaded{config.c_str()};
+    check_same(parsed, loaded, "compiled policy decides like the config file");
+}
+
+/// A compiled file for config that decides like other_contents, so a policy that loads it can be told apart from one
+/// that parsed the config file
+auto forge(std::string const& config) -> std::string {
+    auto const other = (dir / "other.yaml").string();
+    write_file(other, other_contents);
+    Policy{other.c_str()}.save_compiled(Policy::compiled_path(other));
+    std::shared_ptr<void const> mapping;
+    auto file = read_compiled_policy(Policy::compiled_path(other), &mapping).value();
+    std::shared_ptr<void const> config_mapping;
+    auto const compiled = read_compiled_policy(Policy::compiled_path(config), &config_mapping).value();
+    file.source_size = compiled.source_size;
+    file.source_mtime_ns = compiled.source_mtime_ns;
+    file.source_checksum = compiled.source_checksum;
+    write_compiled_policy(file, Policy::compiled_path(config));
+    return read_file(Policy::compiled_path(config));
+}
+
+/// Writes the compiled file with a change, and checks the policy parses the config file instead of loading it
+void expect_ignored(
+    std::string const& config,
+    std::string const& forged,
+    std::string const& changed,
+    char const* what)
+{
+    write_file(Policy::compiled_path(config), changed);
+    std::shared_ptr<void const> mapping;
+    check(!read_compiled_policy(Policy::compiled_path(config), &mapping), what);
+    check(!allows_1001(Policy{config.c_str()}), what);
+    write_file(Policy::compiled_path(config), forged);
+}
+
+void test_rejected(std::string const& config) {
+    auto const forged = forge(config);
+    check(allows_1001(Policy{config.c_str()}), "a compiled file that is up to date is loaded");
+
+    // The magic is followed by the format version
+    auto bumped = forged;
+    bumped[8]++;
+    expect_ignored(config, forged, bumped, "compiled file of another format version is ignored");
+    auto bad_magic = forged;
+    bad_magic[0] = 'W';
+    expect_ignored(config, forged, bad_magic, "file that is not a compiled policy is ignored");
+    expect_ignored(config, forged, forged.substr(0, forged.size() - 1), "truncated compiled file is ignored");
+    expect_ignored(config, forged, forged.substr(0, 20), "compiled file without a whole header is ignored");
+    expect_ignored(config, forged, forged + '\0', "compiled file with trailing data is ignored");
+    auto corrupted = forged;
+    corrupted[corrupted.size() - 20] ^= 1;
+    expect_ignored(config, forged, corrupted, "compiled file failing its payload checksum is ignored");
+
+    // Replacing the contents without changing the size or modification time, like copying tools do
+    auto const mtime = std::filesystem::last_write_time(config);
+    auto replaced = std::string{config_contents};
+    replaced.replace(replaced.find("grim"), 4, "slop");
+    write_file(config, replaced);
+    std::filesystem::last_write_time(config, mtime);
+    std::shared_ptr<void const> mapping;
+    check(read_compiled_policy(Policy::compiled_path(config), &mapping).has_value(), "stale compiled file is valid");
+    check(!allows_1001(Policy{config.c_str()}), "compiled file of other contents of the same size is ignored");
+    write_file(config, config_contents);
+    std::filesystem::last_write_time(config, mtime);
+    check(allows_1001(Policy{config.c_str()}), "config file with the compiled contents uses the compiled file");
+
+    // Touching the config file makes the compiled file stale even though the contents are the same
+    std::filesystem::last_write_time(config, mtime + std::chrono::seconds{1});
+    check(!allows_1001(Policy{config.c_str()}), "compiled file older than the config file is ignored");
+}
+
+}
+
+auto main() -> int {
+    std::filesystem::create_directories(dir);
+    auto const config = (dir / "wlbouncer.yaml").string();
+    test_round_trip(config);
+    test_rejected(config);
+    std::filesystem::remove_all(dir);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include "policy.h"
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+
+// Loads a config file with fragments in its drop-in directory, and reloads it after changing fragments. Runs with
+// meson test.
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, char const* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+auto const dir = std::filesystem::temp_directory_path() / ("wlbouncer-dropin-test-" + std::to_string(getpid()));
+auto const config = (dir / "wlbouncer.yaml").string();
+auto const dropin = dir / "wlbouncer.d";
+
+void write_file(std::filesystem::path const& path, std::string const& contents) {
+    std::ofstream{path, std::ios::trunc} << contents;
+}
+
+/// The directive that decides if uid may use interface, nullopt if the defaults decide, and whether it is allowed
+auto decide(Policy const& policy, uid_t uid, char const* interface) -> std::pair<bool, std::optional<size_t>> {
+    auto const client = policy.client(static_cast<pid_t>(50000 + uid), uid, uid, "user", "users");
+    auto const verdict = policy.explain(*client, policy.find_interface(interface));
+    return {verdict.allowed, verdict.directive};
+}
+
+auto limit(Policy const& policy, Policy::RateScope scope) -> double {
+    auto const& limit = policy.rate_limit(scope);
+    return limit ? limit->rate : 0;
+}
+
+void test_order() {
+    write_file(config,
+        "version: 0\n"
+        "policy:\n"
+        "  - uid: 1001\n"
+        "    disable: [wl_shm]\n"
+        "rate-limit:\n"
+        "  uid: {rate: 1}\n"
+        "  class: {rate: 9}\n");
+    // Listed out of order, fragments apply in lexical order of their names
+    write_file(dropin / "20-b.yaml",
+        "policy:\n"
+        "  - uid: 1001\n"
+        "    enable: [wl_shm]\n"
+        "rate-limit:\n"
+        "  uid: {rate: 3}\n");
+    write_file(dropin / "10-a.yaml",
+        "version: 0\n"
+        "policy:\n"
+        "  - uid: 1002\n"
+        "    disable: [wl_seat]\n"
+        "rate-limit:\n"
+        "  uid: {rate: 2}\n"
+        "  pid: {rate: 7}\n");
+    // Neither is a fragment, hidden files are left by editors while saving
+    write_file(dropin / ".10-a.yaml", "policy: [");
+    write_file(dropin / "README", "policy: [");
+
+    Policy const policy{config.c_str()};
+    check(policy.ok(), "config file with fragments loads");
+    check(policy.directive_count() == 3, "directives of the config file and both fragments");
+    check(decide(policy, 1001, "wl_shm") == std::pair{true, std::optional<size_t>{2}},
+        "later fragment overrides the config file");
+    check(decide(policy, 1002, "wl_seat") == std::pair{false, std::optional<size_t>{1}},
+        "directives of the first fragment come after the config file's");
+    check(limit(policy, Policy::RateScope::uid) == 3, "later fragment replaces the rate limit of a scope");
+    check(limit(policy, Policy::RateScope::pid) == 7, "rate limit of a scope only one fragment sets");
+    check(limit(policy, Policy::RateScope::client_class) == 9, "rate limit of a scope no fragment sets");
+}
+
+void test_reload() {
+    // Unchanged files are not parsed again, which shows when one is edited without changing its size or modification
+    // time. Its stale directives are kept while the fragment that was touched is parsed again.
+    auto const mtime = std::filesystem::last_write_time(dropin / "10-a.yaml");
+    write_file(dropin / "10-a.yaml",
+        "version: 0\n"
+        "policy:\n"
+        "  - uid: 1003\n"
+        "    disable: [wl_seat]\n"
+        "rate-limit:\n"
+        "  uid: {rate: 2}\n"
+        "  pid: {rate: 8}\n");
+    std::filesystem::last_write_time(dropin / "10-a.yaml", mtime);
+    write_file(dropin / "20-b.yaml",
+        "policy:\n"
+        "  - uid: 1001\n"
+        "    enable: [wl_shm, wl_seat]\n"
+        "rate-limit:\n"
+        "  uid: {rate: 4}\n");
+    std::filesystem::last_write_time(dropin / "20-b.yaml", mtime + std::chrono::seconds{1});
+
+    Policy const reloaded{config.c_str()};
+    check(reloaded.ok(), "reloaded config file loads");
+    check(!decide(reloaded, 1002, "wl_seat").first, "unchanged fragment is not parsed again");
+    check(decide(reloaded, 1003, "wl_seat").first, "edits that keep the stamp are not seen");
+    check(limit(reloaded, Policy::RateScope::pid) == 7, "rate limits of the unchanged fragment are kept");
+    check(decide(reloaded, 1001, "wl_seat").first, "touched fragment is parsed again");
+    check(limit(reloaded, Policy::RateScope::uid) == 4, "rate limits of the touched fragment are parsed again");
+
+    // A removed fragment no longer applies, and the next one moves up in its place
+    std::filesystem::remove(dropin / "20-b.yaml");
+    write_file(dropin / "05-c.yaml", "policy:\n  - disable: [wl_output]\n");
+    Policy const removed{config.c_str()};
+    check(removed.directive_count() == 3, "fragment added and another removed");
+    check(decide(removed, 1001, "wl_shm") == std::pair{false, std::optional<size_t>{0}},
+        "removed fragment no longer overrides the config file");
+    check(decide(removed, 1000, "wl_output") == std::pair{false, std::optional<size_t>{1}},
+        "new fragment applies before a later one");
+    check(decide(removed, 1002, "wl_seat") == std::pair{false, std::optional<size_t>{2}},
+        "unchanged fragment after a new one");
+    check(limit(removed, Policy::RateScope::uid) == 2, "rate limit of the removed fragment no longer applies");
+}
+
+}
+
+auto main() -> int {
+    std::filesystem::create_directories(dropin);
+    test_order();
+    test_reload();
+    std::filesystem::remove_all(dir);
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
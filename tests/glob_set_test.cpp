@@ -0,0 +1,133 @@
+#include "glob_set.h"
+#include "policy.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Focused cases for GlobSet's subset construction and the IDs Policy gives names that match patterns. Runs with
+// meson test.
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, char const* what, std::string_view name) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s (%.*s)\n", what, static_cast<int>(name.size()), name.data());
+        failures++;
+    }
+}
+
+/// The patterns name matches, as indexes into the set's patterns
+auto matched(GlobSet const& set, std::string_view name) -> std::vector<uint32_t> {
+    auto const index = set.match(name);
+    return index == GlobSet::no_match ? std::vector<uint32_t>{} : set.match_sets()[index];
+}
+
+void expect(GlobSet const& set, std::string_view name, std::vector<uint32_t> const& patterns) {
+    check(matched(set, name) == patterns, "matched patterns", name);
+}
+
+void test_wildcards() {
+    GlobSet const leading{{"*_manager_v1"}};
+    expect(leading, "zwlr_foo_manager_v1", {0});
+    expect(leading, "_manager_v1", {0});
+    expect(leading, "zwlr_foo_manager_v2", {});
+    expect(leading, "zwlr_foo_manager_v1x", {});
+
+    GlobSet const trailing{{"zwlr_*"}};
+    expect(trailing, "zwlr_", {0});
+    expect(trailing, "zwlr_layer_shell_v1", {0});
+    expect(trailing, "zwl", {});
+    expect(trailing, "xzwlr_", {});
+
+    GlobSet const doubled{{"zwlr_**", "a**b"}};
+    expect(doubled, "zwlr_", {0});
+    expect(doubled, "zwlr_x", {0});
+    expect(doubled, "ab", {1});
+    expect(doubled, "axxb", {1});
+    expect(doubled, "axxbc", {});
+
+    GlobSet const single{{"wl_?hm"}};
+    expect(single, "wl_shm", {0});
+    expect(single, "wl_hm", {});
+    expect(single, "wl_sshm", {});
+}
+
+void test_overlapping() {
+    GlobSet const set{{"zwlr_*", "*_v1", "zwlr_*_v1", "*"}};
+    expect(set, "zwlr_layer_shell_v1", {0, 1, 2, 3});
+    expect(set, "zwlr_x_v2", {0, 3});
+    expect(set, "xdg_v1", {1, 3});
+    expect(set, "wl_shm", {3});
+    expect(set, "", {3});
+    // Names matching the same patterns share a set
+    check(set.match("zwlr_a_v1") == set.match("zwlr_b_c_v1"), "same set for the same patterns", "zwlr_a_v1");
+    check(set.match("zwlr_a_v1") != set.match("zwlr_a_v2"), "different sets for different patterns", "zwlr_a_v2");
+}
+
+void check_policy_ids(Policy const& policy) {
+    check(policy.ok(), "policy loads", policy.path());
+    auto const client = policy.client(1, 1000, 1000, "", "");
+    auto const allowed = [&](std::string_view name) { return policy.check(*client, policy.find_interface(name)); };
+
+    // Listed by name and matched by a pattern, the name's own directive decides
+    check(!allowed("zwlr_layer_shell_v1"), "exact name overrides an earlier pattern", "zwlr_layer_shell_v1");
+    check(allowed("zwlr_foo_manager_v1"), "exact name overrides a later-listed pattern", "zwlr_foo_manager_v1");
+    // Only zwlr_*
+    check(allowed("zwlr_output_manager_v10"), "pattern enables", "zwlr_output_manager_v10");
+    check(policy.find_interface("zwlr_a") == policy.find_interface("zwlr_b"), "shared ID for one pattern", "zwlr_a");
+    // zwlr_* and *_manager_v?, which is neither pattern's own ID
+    check(!allowed("zwlr_screencopy_manager_v1"), "later pattern wins", "zwlr_screencopy_manager_v1");
+    check(
+        policy.find_interface("zwlr_screencopy_manager_v1") != policy.find_interface("zwlr_a"),
+        "distinct ID for two patterns",
+        "zwlr_screencopy_manager_v1");
+    check(
+        policy.find_interface("zwlr_screencopy_manager_v1") == policy.find_interface("zwlr_data_manager_v2"),
+        "shared ID for two patterns",
+        "zwlr_data_manager_v2");
+    // Only *_manager_v?
+    check(!allowed("xdg_foo_manager_v2"), "pattern disables", "xdg_foo_manager_v2");
+    // No pattern
+    check(policy.find_interface("xdg_foo") == policy.interfaces().unknown(), "unknown ID for no pattern", "xdg_foo");
+    check(!allowed("xdg_foo"), "disable all", "xdg_foo");
+}
+
+void test_policy_ids() {
+    auto const path = std::filesystem::temp_directory_path() / ("wlbouncer-glob-test-" + std::to_string(getpid()));
+    std::ofstream{path} << "version: 0\n"
+        "policy:\n"
+        "  - disable: all\n"
+        "  - enable: [zwlr_*]\n"
+        "  - disable: [\"*_manager_v?\"]\n"
+        "  - disable: [zwlr_layer_shell_v1]\n"
+        "  - enable: [zwlr_foo_manager_v1]\n";
+    auto const compiled = Policy::compiled_path(path);
+    {
+        Policy const policy{path.c_str()};
+        check_policy_ids(policy);
+        policy.save_compiled(compiled);
+    }
+    // Loaded from the compiled file this time, which stores patterns by name
+    check_policy_ids(Policy{path.c_str()});
+    std::filesystem::remove(compiled);
+    std::filesystem::remove(path);
+}
+
+}
+
+auto main() -> int {
+    test_wildcards();
+    test_overlapping();
+    test_policy_ids();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
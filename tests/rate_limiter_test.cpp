@@ -0,0 +1,160 @@
+#include "rate_limiter.h"
+#include "wlbouncer.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <wayland-server-core.h>
+
+// RateLimiter's token buckets and set-associative table against a fake clock, and the clients_rejected accounting
+// of a display with a rate limit. Runs with meson test.
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, char const* what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/// The fake clock, in milliseconds since it started
+auto at(int64_t ms) -> std::chrono::steady_clock::time_point {
+    return std::chrono::steady_clock::time_point{} + std::chrono::seconds{1} + std::chrono::milliseconds{ms};
+}
+
+void test_burst_and_refill() {
+    RateLimiter limiter{2, 3};
+    // A new key starts with a full bucket
+    check(limiter.take(7, at(0)), "first token of the burst");
+    check(limiter.take(7, at(0)), "second token of the burst");
+    check(limiter.take(7, at(0)), "third token of the burst");
+    check(!limiter.take(7, at(0)), "burst exhausted");
+    // 2 per second is one token every 500 ms, and a refused take still counts as the last use
+    check(!limiter.take(7, at(400)), "not refilled after 400 ms");
+    check(limiter.take(7, at(500)), "refilled after 500 ms");
+    check(!limiter.take(7, at(500)), "only one token refilled");
+    // A long idle period refills to the burst and no further
+    for (int i = 0; i < 3; i++) {
+        check(limiter.take(7, at(60000)), "refilled up to the burst");
+    }
+    check(!limiter.take(7, at(60000)), "not refilled past the burst");
+}
+
+void test_keys() {
+    RateLimiter limiter{0.001, 1};
+    check(limiter.take(1, at(0)), "key 1 has its own bucket");
+    check(limiter.take(2, at(0)), "key 2 has its own bucket");
+    check(!limiter.take(1, at(1)), "key 1 exhausted");
+    check(!limiter.take(2, at(1)), "key 2 exhausted");
+    // Zero is a valid key, even though zero also marks unused buckets' times
+    check(limiter.take(0, at(2)), "key 0 has its own bucket");
+    check(!limiter.take(0, at(3)), "key 0 exhausted");
+}
+
+/// Keys in the same set of the table, computed the way take() picks a set
+auto colliding_keys(size_t count) -> std::vector<uint64_t> {
+    auto const set_of = [](uint64_t key) { return ((key * 0x9e3779b97f4a7c15) >> 56) % 256; };
+    std::vector<uint64_t> keys;
+    for (uint64_t key = 1; keys.size() < count; key++) {
+        if (set_of(key) == set_of(1)) {
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+void test_eviction() {
+    // Practically no refill, so an exhausted key only gets a token back by losing its bucket
+    RateLimiter limiter{1e-9, 1};
+    auto const keys = colliding_keys(6);
+    auto const other_set = keys[0] + 1;
+    check(limiter.take(other_set, at(0)), "key of another set gets a bucket");
+    for (int i = 0; i < 4; i++) {
+        check(limiter.take(keys[i], at(i)), "filling the set");
+    }
+    // The set has 4 ways, a fifth key evicts the least recently used, keys[0]
+    check(limiter.take(keys[4], at(10)), "fifth key gets a bucket");
+    // A refused take counts as a use, so keys[2] is now the least recently used
+    check(!limiter.take(keys[1], at(11)), "keys[1] kept its empty bucket");
+    check(limiter.take(keys[5], at(12)), "sixth key gets a bucket");
+    check(!limiter.take(keys[1], at(13)), "recently used keys[1] was not evicted");
+    check(!limiter.take(keys[3], at(14)), "keys[3] was not evicted");
+    check(limiter.take(keys[0], at(15)), "evicted keys[0] gets a full bucket again");
+    check(limiter.take(keys[2], at(16)), "evicted keys[2] gets a full bucket again");
+    // Evicting in one set leaves the buckets of the others alone
+    check(!limiter.take(other_set, at(17)), "key of another set kept its empty bucket");
+}
+
+struct DestroyCounter {
+    wl_listener listener;
+    int* destroyed;
+};
+
+void count_destroyed(wl_listener* listener, void*) {
+    DestroyCounter* counter = wl_container_of(listener, counter, listener);
+    (*counter->destroyed)++;
+    delete counter;
+}
+
+void test_display_rejects() {
+    auto const path = std::filesystem::temp_directory_path()
+        / ("wlbouncer-rate-limit-test-" + std::to_string(getpid()) + ".yaml");
+    std::ofstream{path} << "version: 0\npolicy: []\nrate-limit:\n  pid: {rate: 0.001, burst: 2}\n";
+    auto const display = wl_display_create();
+    wl_bouncer_init_for_display(display, path.c_str(), nullptr, nullptr);
+    int destroyed = 0;
+    std::vector<int> fds;
+    auto const connect = [&]() {
+        int pair[2];
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair);
+        fds.push_back(pair[1]);
+        auto const client = wl_client_create(display, pair[0]);
+        auto const counter = new DestroyCounter{{}, &destroyed};
+        counter->listener.notify = &count_destroyed;
+        wl_client_add_destroy_listener(client, &counter->listener);
+        return client;
+    };
+    // Every client has this process's PID, so only the first two fit in the burst
+    for (int i = 0; i < 5; i++) {
+        connect();
+    }
+    check(destroyed == 0, "rejected clients survive until the event loop runs");
+    // Destroying a rejected client before the loop runs must cancel its pending rejection
+    wl_client_destroy(connect());
+    wl_event_loop_dispatch(wl_display_get_event_loop(display), 0);
+    check(destroyed == 4, "three rejected clients destroyed by the event loop, one by the test");
+
+    wl_bouncer_stats stats{};
+    stats.struct_size = sizeof(stats);
+    check(wl_bouncer_get_stats(display, &stats), "stats available");
+    check(stats.clients_created == 6, "rejected clients are counted as created");
+    check(stats.clients_rejected == 4, "clients over the limit are counted as rejected");
+    wl_display_destroy_clients(display);
+    wl_display_destroy(display);
+    std::filesystem::remove(path);
+    for (auto const fd : fds) {
+        close(fd);
+    }
+}
+
+}
+
+auto main() -> int {
+    test_burst_and_refill();
+    test_keys();
+    test_eviction();
+    test_display_rejects();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
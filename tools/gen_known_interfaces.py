@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Generates a header with a perfect hash of every interface name in the given protocol XML files or directories,
+# see src/known_interfaces.h for how it is looked up
+
+import argparse
+import os
+import re
+import sys
+
+INTERFACE = re.compile(rb'<interface\s+name="([^"]+)"')
+MASK64 = (1 << 64) - 1
+MASK32 = (1 << 32) - 1
+MAX_DISPLACEMENT = 1 << 16
+
+
+# Must match known_interfaces::hash() in src/known_interfaces.h
+def fnv1a(name):
+    h = 0xcbf29ce484222325
+    for byte in name.encode():
+        h = ((h ^ byte) * 0x100000001b3) & MASK64
+    return h
+
+
+# Must match known_interfaces::slot() in src/known_interfaces.h
+def slot(h, displacement, table_size):
+    x = ((h & MASK32) ^ ((displacement * 0x9e3779b9) & MASK32)) & MASK32
+    x ^= x >> 16
+    x = (x * 0x85ebca6b) & MASK32
+    x ^= x >> 13
+    x = (x * 0xc2b2ae35) & MASK32
+    x ^= x >> 16
+    return x & (table_size - 1)
+
+
+def xml_files(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for root, dirs, files in os.walk(path):
+                dirs.sort()
+                for file in sorted(files):
+                    if file.endswith('.xml'):
+                        yield os.path.join(root, file)
+        elif os.path.isfile(path):
+            yield path
+
+
+def build(names, table_size):
+    """Hash and displace: buckets are placed largest first, each with the first displacement that puts all of its
+    names in free slots. Returns None if some bucket can not be placed."""
+    bucket_count = max(1, (len(names) + 3) // 4)
+    hashes = [fnv1a(name) for name in names]
+    buckets = [[] for _ in range(bucket_count)]
+    for index, h in enumerate(hashes):
+        buckets[(h >> 32) % bucket_count].append(index)
+    displacements = [0] * bucket_count
+    slots = [0] * table_size
+    for bucket in sorted(range(bucket_count), key=lambda b: -len(buckets[b])):
+        if not buckets[bucket]:
+            break
+        for displacement in range(MAX_DISPLACEMENT):
+            placed = {slot(hashes[i], displacement, table_size) for i in buckets[bucket]}
+            if len(placed) == len(buckets[bucket]) and not any(slots[s] for s in placed):
+                for i in buckets[bucket]:
+                    slots[slot(hashes[i], displacement, table_size)] = i + 1
+                displacements[bucket] = displacement
+                break
+        else:
+            return None
+    return displacements, slots
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generates a perfect hash of known Wayland interface names')
+    parser.add_argument('--output', required=True)
+    parser.add_argument('paths', nargs='*', help='protocol XML files or directories to search for them')
+    args = parser.parse_args()
+
+    files = list(xml_files(args.paths))
+    names = set()
+    for path in files:
+        with open(path, 'rb') as file:
+            names.update(match.decode() for match in INTERFACE.findall(file.read()))
+    names = sorted(names)
+
+    table_size = 1
+    while table_size < len(names):
+        table_size *= 2
+    while (result := build(names, table_size)) is None:
+        table_size *= 2
+    displacements, slots = result
+
+    def rows(values, per_row):
+        return '\n'.join('    ' + ' '.join(values[i:i + per_row]) for i in range(0, len(values), per_row))
+
+    with open(args.output, 'w') as out:
+        out.write(f'''// Generated by tools/gen_known_interfaces.py from {len(files)} protocol XML files, do not edit
+
+#ifndef WL_BOUNCER_KNOWN_INTERFACES_TABLE_H
+#define WL_BOUNCER_KNOWN_INTERFACES_TABLE_H
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace known_interfaces {{
+
+inline constexpr std::array<std::string_view, {len(names)}> names{{
+{rows([f'"{name}",' for name in names], 1)}
+}};
+
+inline constexpr std::array<uint16_t, {len(displacements)}> displacements{{
+{rows([f'{d},' for d in displacements], 16)}
+}};
+
+/// Index into names plus one for each slot, 0 for empty slots
+inline constexpr std::array<uint16_t, {table_size}> slots{{
+{rows([f'{s},' for s in slots], 16)}
+}};
+
+}}
+
+#endif // WL_BOUNCER_KNOWN_INTERFACES_TABLE_H
+''')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
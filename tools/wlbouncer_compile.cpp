@@ -0,0 +1,28 @@
+// Compiles a wlbouncer config file into the binary form the library loads instead of parsing YAML
+
+#include "policy.h"
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if (argc > 3 || (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))) {
+        std::cerr << "usage: " << argv[0] << " [CONFIG_FILE [OUTPUT_FILE]]" << std::endl
+            << "Compiles CONFIG_FILE (found the same way wlbouncer finds it if not given) into OUTPUT_FILE" << std::endl
+            << "(CONFIG_FILE" << Policy::compiled_path("") << " by default). wlbouncer loads the compiled file" << std::endl
+            << "instead of the config file as long as the config file has not changed since it was compiled." << std::endl;
+        return argc > 3 ? 1 : 0;
+    }
+    Policy const policy{argc > 1 ? argv[1] : nullptr};
+    if (!policy.ok()) {
+        return 1;
+    }
+    auto const output = argc > 2 ? std::string{argv[2]} : Policy::compiled_path(policy.path());
+    try {
+        policy.save_compiled(output);
+    } catch (std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "compiled " << policy.path() << " into " << output << std::endl;
+    return 0;
+}
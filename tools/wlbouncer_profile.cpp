@@ -0,0 +1,320 @@
+// Evaluates a wlbouncer config for a set of clients and interfaces and reports what each directive costs and decides
+
+#include "policy.h"
+#include "name_resolver.h"
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <tuple>
+
+namespace {
+
+struct Credentials {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    std::string username;
+    std::string groupname;
+
+    auto operator<(Credentials const& other) const -> bool {
+        return std::tie(pid, uid, gid) < std::tie(other.pid, other.uid, other.gid);
+    }
+};
+
+struct DirectiveProfile {
+    uint64_t matched = 0;
+    uint64_t decided = 0;
+    /// Evaluating the conditions for a new client, including reading what they need from /proc
+    std::chrono::nanoseconds first_time{0};
+    /// Evaluating them again, once what they read from /proc is kept by the client
+    std::chrono::nanoseconds time{0};
+};
+
+void usage(char const* argv0) {
+    std::cerr << "usage: " << argv0 << " [OPTIONS] [CONFIG_FILE]" << std::endl
+        << "Evaluates every client against every interface and reports, for each directive, how many" << std::endl
+        << "clients its conditions matched, how often it decided the result and how long its conditions" << std::endl
+        << "took, summed over all clients: first for a new client, which includes reading /proc, and again" << std::endl
+        << "once that is kept. Flags directives that never match, never decide or are always overridden" << std::endl
+        << "by a later one." << std::endl
+        << std::endl
+        << "  --clients FILE     clients to evaluate, one 'pid uid gid [user [group]]' per line" << std::endl
+        << "  --interfaces FILE  interface names to evaluate, one per line" << std::endl
+        << "  --audit FILE       take clients and interfaces from a JSON audit log (see BOUNCER_AUDIT)" << std::endl
+        << "  --synthetic N      add N generated clients (100 if no clients are given)" << std::endl
+        << "  --repeat N         evaluate each directive N more times for more stable timings (default 10)" << std::endl
+        << "  --strict           exit with status 2 if any directive is dead or shadowed, or any interface in the" << std::endl
+        << "                     config is not in a protocol known when wlbouncer was built" << std::endl;
+}
+
+auto with_names(pid_t pid, uid_t uid, gid_t gid) -> Credentials {
+    return {
+        pid,
+        uid,
+        gid,
+        resolve_username(uid).value_or("user" + std::to_string(uid)),
+        resolve_groupname(gid).value_or("group" + std::to_string(gid)),
+    };
+}
+
+void read_clients(std::string const& path, std::set<Credentials>& clients) {
+    std::ifstream file{path};
+    if (!file) {
+        throw std::runtime_error{"failed to open " + path};
+    }
+    for (std::string line; std::getline(file, line);) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields{line};
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+        if (!(fields >> pid >> uid >> gid)) {
+            throw std::runtime_error{"invalid client line in " + path + ": " + line};
+        }
+        auto client = with_names(pid, uid, gid);
+        fields >> client.username >> client.groupname;
+        clients.insert(client);
+    }
+}
+
+void read_interfaces(std::string const& path, std::set<std::string>& interfaces) {
+    std::ifstream file{path};
+    if (!file) {
+        throw std::runtime_error{"failed to open " + path};
+    }
+    for (std::string line; std::getline(file, line);) {
+        if (!line.empty() && line[0] != '#') {
+            interfaces.insert(line);
+        }
+    }
+}
+
+/// Returns the text after "key": up to the next delimiter, or an empty string
+auto json_field(std::string const& line, std::string const& key) -> std::string {
+    auto const pattern = "\"" + key + "\":";
+    auto start = line.find(pattern);
+    if (start == std::string::npos) {
+        return {};
+    }
+    start += pattern.size();
+    if (line[start] == '"') {
+        return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+    }
+    return line.substr(start, line.find_first_of(",}", start) - start);
+}
+
+void read_audit_log(std::string const& path, std::set<Credentials>& clients, std::set<std::string>& interfaces) {
+    std::ifstream file{path};
+    if (!file) {
+        throw std::runtime_error{"failed to open " + path};
+    }
+    for (std::string line; std::getline(file, line);) {
+        auto const pid = json_field(line, "pid");
+        auto const uid = json_field(line, "uid");
+        auto const gid = json_field(line, "gid");
+        if (pid.empty() || uid.empty() || gid.empty()) {
+            continue;
+        }
+        clients.insert(with_names(std::stoi(pid), std::stoul(uid), std::stoul(gid)));
+        auto const interface = json_field(line, "interface");
+        if (!interface.empty()) {
+            interfaces.insert(interface);
+        }
+    }
+}
+
+/// The number of single character insertions, deletions and substitutions that turn a into b
+auto edit_distance(std::string_view a, std::string_view b) -> size_t {
+    std::vector<size_t> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        auto diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); j++) {
+            auto const above = row[j];
+            row[j] = std::min({above + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = above;
+        }
+    }
+    return row[b.size()];
+}
+
+/// The known interface closest to name, if it is close enough to be a likely typo
+auto suggest_interface(std::string_view name) -> std::optional<std::string_view> {
+    std::optional<std::string_view> best;
+    auto best_distance = std::max(size_t{2}, name.size() / 4) + 1;
+    for (auto const known : InterfaceTable::known_names()) {
+        auto const distance = edit_distance(name, known);
+        if (distance < best_distance) {
+            best = known;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+/// The compositor, its parent, root and a spread of ordinary users
+void add_synthetic_clients(int count, std::set<Credentials>& clients) {
+    clients.insert(with_names(getpid(), getuid(), getgid()));
+    clients.insert(with_names(getppid(), getuid(), getgid()));
+    clients.insert(with_names(1, 0, 0));
+    std::mt19937 random{12345};
+    std::vector<uid_t> const uids{0, getuid(), 1000, 1001, 1002, 65534};
+    for (int i = 0; i < count; i++) {
+        auto const uid = uids[random() % uids.size()];
+        clients.insert(with_names(100000 + i, uid, uid));
+    }
+}
+}
+
+auto main(int argc, char** argv) -> int {
+    std::set<Credentials> clients;
+    std::set<std::string> interfaces;
+    int synthetic = -1;
+    int repeat = 10;
+    bool strict = false;
+    char const* config_file = nullptr;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string const arg = argv[i];
+            auto const value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error{arg + " needs a value"};
+                }
+                return argv[++i];
+            };
+            if (arg == "--clients") {
+                read_clients(value(), clients);
+            } else if (arg == "--interfaces") {
+                read_interfaces(value(), interfaces);
+            } else if (arg == "--audit") {
+                read_audit_log(value(), clients, interfaces);
+            } else if (arg == "--synthetic") {
+                synthetic = std::stoi(value());
+            } else if (arg == "--repeat") {
+                repeat = std::max(1, std::stoi(value()));
+            } else if (arg == "--strict") {
+                strict = true;
+            } else if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            } else if (arg.starts_with("-") || config_file) {
+                usage(argv[0]);
+                return 1;
+            } else {
+                config_file = argv[i];
+            }
+        }
+    } catch (std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    if (synthetic > 0 || (synthetic < 0 && clients.empty())) {
+        add_synthetic_clients(synthetic < 0 ? 100 : synthetic, clients);
+    }
+
+    Policy const policy{config_file};
+    if (!policy.ok()) {
+        return 1;
+    }
+    if (interfaces.empty()) {
+        for (InterfaceId id = 0; id < policy.interfaces().unknown(); id++) {
+            interfaces.insert(std::string{policy.interfaces().name(id)});
+        }
+        // Stands in for every interface the config does not mention
+        interfaces.insert("wlbouncer_profile_unlisted_v1");
+    }
+    std::vector<InterfaceId> ids;
+    for (auto const& name : interfaces) {
+        ids.push_back(policy.find_interface(name));
+    }
+
+    auto const directive_count = policy.directive_count();
+    std::vector<DirectiveProfile> profiles(directive_count);
+    uint64_t decided_by_defaults = 0;
+    std::chrono::nanoseconds client_time{0};
+    std::chrono::nanoseconds check_time{0};
+    for (auto const& credentials : clients) {
+        auto start = std::chrono::steady_clock::now();
+        auto const client = policy.client(
+            credentials.pid, credentials.uid, credentials.gid, credentials.username, credentials.groupname);
+        client_time += std::chrono::steady_clock::now() - start;
+        for (size_t i = 0; i < directive_count; i++) {
+            auto& profile = profiles[i];
+            // client() already read what the conditions need, so each directive times reading it again
+            Policy::forget_process_attributes(*client);
+            start = std::chrono::steady_clock::now();
+            auto const matched = policy.directive_matches(*client, i);
+            profile.first_time += std::chrono::steady_clock::now() - start;
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeat; r++) {
+                policy.directive_matches(*client, i);
+            }
+            profile.time += (std::chrono::steady_clock::now() - start) / repeat;
+            profile.matched += matched;
+        }
+        start = std::chrono::steady_clock::now();
+        for (auto const id : ids) {
+            auto const verdict = policy.explain(*client, id);
+            if (verdict.directive) {
+                profiles[verdict.directive.value()].decided++;
+            } else {
+                decided_by_defaults++;
+            }
+        }
+        check_time += std::chrono::steady_clock::now() - start;
+    }
+
+    auto const checks = clients.size() * ids.size();
+    std::cout << "policy: " << policy.path() << " (" << directive_count << " directives, "
+        << policy.interfaces().unknown() << " interfaces)" << std::endl
+        << "evaluated " << clients.size() << " clients against " << ids.size() << " interfaces" << std::endl
+        << "client(): " << (clients.empty() ? 0 : client_time.count() / clients.size()) << " ns/client, "
+        << "explain(): " << (checks ? check_time.count() / checks : 0) << " ns/check" << std::endl
+        << "decided by defaults: " << decided_by_defaults << " of " << checks << std::endl
+        << std::endl
+        << std::setw(6) << "#" << std::setw(9) << "matched" << std::setw(9) << "decided"
+        << std::setw(13) << "first (ns)" << std::setw(13) << "again (ns)" << "  directive" << std::endl;
+    bool dead = false;
+    for (size_t i = 0; i < directive_count; i++) {
+        auto const& profile = profiles[i];
+        std::string note;
+        if (auto const shadow = policy.shadowing_directive(i)) {
+            note = "shadowed by #" + std::to_string(shadow.value());
+        } else if (profile.matched == 0) {
+            note = "never matched";
+        } else if (profile.decided == 0) {
+            note = "never decided";
+        }
+        dead = dead || !note.empty();
+        auto description = policy.describe_directive(i);
+        if (description.size() > 100) {
+            description = description.substr(0, 97) + "...";
+        }
+        std::cout << std::setw(6) << i << std::setw(9) << profile.matched << std::setw(9) << profile.decided
+            << std::setw(13) << profile.first_time.count() << std::setw(13) << profile.time.count() << "  "
+            << description << (note.empty() ? "" : "  (" + note + ")") << std::endl;
+    }
+    auto const unrecognized = policy.unrecognized_interfaces();
+    if (!unrecognized.empty()) {
+        std::cout << std::endl << "not in any protocol known at build time:" << std::endl;
+    }
+    for (auto const name : unrecognized) {
+        auto const suggestion = suggest_interface(name);
+        std::cout << "  " << name << (suggestion ? " (did you mean " + std::string{suggestion.value()} + "?)" : "")
+            << std::endl;
+    }
+    return strict && (dead || !unrecognized.empty()) ? 2 : 0;
+}
@@ -0,0 +1,445 @@
+// Replays a filter workload captured with BOUNCER_CAPTURE against a config and reports throughput and latency
+
+#include "capture.h"
+#include "name_resolver.h"
+#include "policy.h"
+#include "wlbouncer.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <wayland-server-core.h>
+
+extern void (*real_wl_display_set_global_filter)(
+    wl_display* display,
+    wl_display_global_filter_func_t filter,
+    void* data
+);
+
+namespace {
+
+struct Credentials {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+};
+
+struct Event {
+    CaptureEvent::Kind kind;
+    uint32_t client;
+    /// Index into Trace::globals for filter events
+    uint32_t global;
+    bool allowed;
+};
+
+struct TraceGlobal {
+    uint16_t interface;
+    bool tracked;
+};
+
+/// One replay of a trace
+struct Pass {
+    /// Only the events, not setting up and tearing down the display
+    std::chrono::nanoseconds elapsed;
+    size_t differences;
+};
+
+struct Trace {
+    std::vector<Event> events;
+    /// Indexed by client ID
+    std::vector<Credentials> clients;
+    std::vector<std::string> interfaces;
+    /// Each distinct address and interface a filter event was about
+    std::vector<TraceGlobal> globals;
+    uint64_t duration_ns = 0;
+    uint64_t dropped = 0;
+    size_t filter_events = 0;
+    /// Filter calls the policy never saw, which are counted but not replayed
+    size_t unknown_client_calls = 0;
+    size_t chained_denied_calls = 0;
+};
+
+void usage(char const* argv0) {
+    std::cerr << "usage: " << argv0 << " [OPTIONS] TRACE [CONFIG_FILE]" << std::endl
+        << "Runs the client connections and filter calls in TRACE (written by wlbouncer when" << std::endl
+        << "BOUNCER_CAPTURE is set) against CONFIG_FILE as fast as possible, and reports throughput, the" << std::endl
+        << "latency of each filter call and how many decisions differ from the ones in the trace." << std::endl
+        << "Connection rate limits in the config apply to the replay's own pace, and exe, cgroup and" << std::endl
+        << "app-id conditions see whatever processes have the recorded PIDs now. Filter calls the" << std::endl
+        << "compositor's own filter denied are counted but not replayed." << std::endl
+        << std::endl
+        << "  --mode MODE   filter: wlbouncer's global filter on a real display (the default)" << std::endl
+        << "                policy: Policy::check() only, with one Policy::Client per client" << std::endl
+        << "  --repeat N    replay the trace N times for throughput (default 5)" << std::endl;
+}
+
+template<typename T>
+auto read(std::istream& in) -> T {
+    T value;
+    if (!in.read(reinterpret_cast<char*>(&value), sizeof(value))) {
+        throw std::runtime_error{"truncated trace"};
+    }
+    return value;
+}
+
+auto read_trace(std::string const& path) -> Trace {
+    std::ifstream in{path, std::ios::binary};
+    if (!in) {
+        throw std::runtime_error{"failed to open " + path};
+    }
+    char magic[sizeof(Capture::magic)];
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, Capture::magic, sizeof(magic)) != 0) {
+        throw std::runtime_error{path + " is not a wlbouncer trace"};
+    }
+    // Version 1 only lacks the flags of calls that bypassed the policy
+    if (auto const version = read<uint32_t>(in); version < 1 || version > Capture::version) {
+        throw std::runtime_error{path + " has an unsupported trace version"};
+    }
+    Trace trace;
+    // Maps the trace's interface numbers to its names and each address and interface to a global
+    std::vector<uint16_t> interface_index;
+    std::map<std::pair<uint64_t, uint16_t>, uint32_t> global_index;
+    for (int kind; (kind = in.get()) != EOF;) {
+        trace.duration_ns = read<uint64_t>(in);
+        if (kind == static_cast<int>(CaptureEvent::Kind::client_created)) {
+            auto const client = read<uint32_t>(in);
+            Credentials credentials;
+            credentials.pid = read<int32_t>(in);
+            credentials.uid = read<uint32_t>(in);
+            credentials.gid = read<uint32_t>(in);
+            if (client >= trace.clients.size()) {
+                trace.clients.resize(client + 1);
+            }
+            trace.clients[client] = credentials;
+            trace.events.push_back({CaptureEvent::Kind::client_created, client, 0, false});
+        } else if (kind == static_cast<int>(CaptureEvent::Kind::client_destroyed)) {
+            trace.events.push_back({CaptureEvent::Kind::client_destroyed, read<uint32_t>(in), 0, false});
+        } else if (kind == Capture::interface_record) {
+            auto const interface = read<uint16_t>(in);
+            std::string name(read<uint16_t>(in), '\0');
+            if (!in.read(name.data(), name.size())) {
+                throw std::runtime_error{"truncated trace"};
+            }
+            if (interface >= interface_index.size()) {
+                interface_index.resize(interface + 1);
+            }
+            interface_index[interface] = static_cast<uint16_t>(trace.interfaces.size());
+            trace.interfaces.push_back(std::move(name));
+        } else if (kind == static_cast<int>(CaptureEvent::Kind::filter)) {
+            auto const client = read<uint32_t>(in);
+            auto const address = read<uint64_t>(in);
+            auto const interface = read<uint16_t>(in);
+            auto const flags = read<uint8_t>(in);
+            if (interface >= interface_index.size()) {
+                throw std::runtime_error{"filter record before the name of its interface"};
+            }
+            // Neither the compositor's filter nor unknown clients can be replayed
+            if (flags & Capture::unknown_client_flag) {
+                trace.unknown_client_calls++;
+                continue;
+            }
+            if (flags & Capture::chained_denied_flag) {
+                trace.chained_denied_calls++;
+                continue;
+            }
+            if (client >= trace.clients.size()) {
+                // Its client_created record was dropped, its filter calls are replayed as denied
+                trace.clients.resize(client + 1);
+            }
+            auto const [iter, inserted] = global_index.emplace(
+                std::pair{address, interface_index[interface]}, static_cast<uint32_t>(trace.globals.size()));
+            if (inserted) {
+                trace.globals.push_back({interface_index[interface], (flags & Capture::tracked_flag) != 0});
+            }
+            trace.events.push_back(
+                {CaptureEvent::Kind::filter, client, iter->second, (flags & Capture::allowed_flag) != 0});
+            trace.filter_events++;
+        } else if (kind == Capture::dropped_record) {
+            trace.dropped += read<uint64_t>(in);
+        } else {
+            throw std::runtime_error{"unknown record " + std::to_string(kind) + " in trace"};
+        }
+    }
+    return trace;
+}
+
+/// Credentials handed to libwayland's callers for the clients the replay creates, see wl_client_get_credentials()
+std::unordered_map<wl_client const*, Credentials> replay_credentials;
+Credentials next_credentials;
+
+wl_display_global_filter_func_t captured_filter = nullptr;
+void* captured_filter_data = nullptr;
+
+void capture_filter(wl_display*, wl_display_global_filter_func_t filter, void* data) {
+    captured_filter = filter;
+    captured_filter_data = data;
+}
+
+void bind_nothing(wl_client*, void*, uint32_t, uint32_t) {}
+
+/// Replays the trace through wlbouncer's filter on a real display, one replay per call to run()
+class FilterReplay {
+public:
+    FilterReplay(Trace const& trace, char const* config_file) :
+        trace{trace},
+        config_file{config_file}
+    {
+        for (auto const& name : trace.interfaces) {
+            interfaces.push_back(wl_interface{name.c_str(), 1, 0, nullptr, 0, nullptr});
+        }
+    }
+
+    /// Calls on_filter(start, allowed) after each filter call
+    template<typename F>
+    auto run(F&& on_filter) -> Pass {
+        auto const display = wl_display_create();
+        real_wl_display_set_global_filter = capture_filter;
+        wl_bouncer_init_for_display(display, config_file, nullptr, nullptr);
+        auto const filter = captured_filter;
+        auto const filter_data = captured_filter_data;
+        std::vector<wl_global*> globals;
+        for (auto const& global : trace.globals) {
+            globals.push_back(wl_global_create(display, &interfaces[global.interface], 1, nullptr, bind_nothing));
+            if (global.tracked) {
+                wl_bouncer_global_created(globals.back());
+            }
+        }
+        std::vector<std::pair<wl_client*, int>> clients(trace.clients.size(), {nullptr, -1});
+        size_t differences = 0;
+        auto const start = std::chrono::steady_clock::now();
+        for (auto const& event : trace.events) {
+            auto& [client, fd] = clients[event.client];
+            switch (event.kind) {
+            case CaptureEvent::Kind::client_created: {
+                int fds[2];
+                socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+                next_credentials = trace.clients[event.client];
+                client = wl_client_create(display, fds[0]);
+                replay_credentials[client] = next_credentials;
+                fd = fds[1];
+                break;
+            }
+            case CaptureEvent::Kind::client_destroyed:
+                if (client) {
+                    destroy_client(client, fd);
+                }
+                break;
+            case CaptureEvent::Kind::filter: {
+                auto const start = std::chrono::steady_clock::now();
+                auto const allowed = client && filter(client, globals[event.global], filter_data);
+                on_filter(start, allowed);
+                differences += allowed != event.allowed;
+                break;
+            }
+            }
+        }
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        for (auto& [client, fd] : clients) {
+            if (client) {
+                destroy_client(client, fd);
+            }
+        }
+        for (auto const global : globals) {
+            wl_bouncer_global_destroyed(global);
+            wl_global_destroy(global);
+        }
+        wl_display_destroy(display);
+        return {elapsed, differences};
+    }
+
+private:
+    Trace const& trace;
+    char const* const config_file;
+    std::deque<wl_interface> interfaces;
+
+    void destroy_client(wl_client*& client, int& fd) {
+        wl_client_destroy(client);
+        replay_credentials.erase(client);
+        close(fd);
+        client = nullptr;
+        fd = -1;
+    }
+};
+
+/// Replays the trace through Policy::check() alone
+class PolicyReplay {
+public:
+    PolicyReplay(Trace const& trace, char const* config_file) :
+        trace{trace},
+        policy{config_file}
+    {
+        for (auto const& name : trace.interfaces) {
+            interface_ids.push_back(policy.find_interface(name));
+        }
+    }
+
+    auto ok() const -> bool { return policy.ok(); }
+
+    template<typename F>
+    auto run(F&& on_filter) -> Pass {
+        std::vector<std::shared_ptr<Policy::Client const>> clients(trace.clients.size());
+        size_t differences = 0;
+        auto const start = std::chrono::steady_clock::now();
+        for (auto const& event : trace.events) {
+            auto& client = clients[event.client];
+            switch (event.kind) {
+            case CaptureEvent::Kind::client_created: {
+                auto const& credentials = trace.clients[event.client];
+                auto& resolver = NameResolver::get();
+                client = policy.client(
+                    credentials.pid,
+                    credentials.uid,
+                    credentials.gid,
+                    policy.needs_username() ? resolver.user_now(credentials.uid).name : std::string{},
+                    policy.needs_groupname() ? resolver.group_now(credentials.gid).name : std::string{});
+                break;
+            }
+            case CaptureEvent::Kind::client_destroyed:
+                client.reset();
+                break;
+            case CaptureEvent::Kind::filter: {
+                auto const start = std::chrono::steady_clock::now();
+                auto const interface = interface_ids[trace.globals[event.global].interface];
+                auto const allowed = client && policy.check(*client, interface);
+                on_filter(start, allowed);
+                differences += allowed != event.allowed;
+                break;
+            }
+            }
+        }
+        return {std::chrono::steady_clock::now() - start, differences};
+    }
+
+private:
+    Trace const& trace;
+    Policy const policy;
+    std::vector<InterfaceId> interface_ids;
+};
+
+volatile bool sink;
+
+template<typename Replay>
+void report(Replay& replay, Trace const& trace, int repeat) {
+    // Throughput from untimed passes, so reading the clock does not count
+    size_t differences = 0;
+    std::chrono::nanoseconds total{0};
+    for (int i = 0; i < repeat; i++) {
+        auto const pass = replay.run([](auto, bool allowed) { sink = allowed; });
+        total += pass.elapsed;
+        differences = pass.differences;
+    }
+    auto const elapsed = std::chrono::duration<double>(total).count() / repeat;
+    // Latency from one more pass that reads the clock around every filter call
+    std::vector<uint32_t> latencies;
+    latencies.reserve(trace.filter_events);
+    replay.run([&](std::chrono::steady_clock::time_point call_start, bool allowed) {
+        auto const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - call_start).count();
+        latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+        sink = allowed;
+    });
+    std::sort(latencies.begin(), latencies.end());
+    auto const percentile = [&](double p) -> uint32_t {
+        return latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))];
+    };
+    std::cout << std::fixed << std::setprecision(1)
+        << "replay: " << elapsed * 1e6 << " us per pass, "
+        << trace.events.size() / elapsed / 1e6 << "M events/s, "
+        << trace.filter_events / elapsed / 1e6 << "M filter calls/s" << std::endl
+        << "filter latency (ns, including a clock read): p50 " << percentile(0.5)
+        << ", p90 " << percentile(0.9)
+        << ", p99 " << percentile(0.99)
+        << ", p99.9 " << percentile(0.999)
+        << ", max " << (latencies.empty() ? 0 : latencies.back()) << std::endl
+        << "decisions that differ from the trace: " << differences << " of " << trace.filter_events << std::endl;
+}
+}
+
+/// Replaces libwayland's, so the filter sees the recorded credentials rather than the replay's own
+extern "C" void wl_client_get_credentials(wl_client* client, pid_t* pid, uid_t* uid, gid_t* gid) {
+    auto const iter = replay_credentials.find(client);
+    // Asked while the client is still being created, before the replay knows its address
+    auto const& credentials = iter == replay_credentials.end() ? next_credentials : iter->second;
+    *pid = credentials.pid;
+    *uid = credentials.uid;
+    *gid = credentials.gid;
+}
+
+auto main(int argc, char** argv) -> int {
+    std::string mode = "filter";
+    int repeat = 5;
+    std::vector<char const*> paths;
+    Trace trace;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string const arg = argv[i];
+            auto const value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::runtime_error{arg + " needs a value"};
+                }
+                return argv[++i];
+            };
+            if (arg == "--mode") {
+                mode = value();
+            } else if (arg == "--repeat") {
+                repeat = std::max(1, std::stoi(value()));
+            } else if (arg == "-h" || arg == "--help") {
+                usage(argv[0]);
+                return 0;
+            } else if (arg.starts_with("-") || paths.size() == 2) {
+                usage(argv[0]);
+                return 1;
+            } else {
+                paths.push_back(argv[i]);
+            }
+        }
+        if (paths.empty() || (mode != "filter" && mode != "policy")) {
+            usage(argv[0]);
+            return 1;
+        }
+        trace = read_trace(paths[0]);
+    } catch (std::exception& e) {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    auto const config_file = paths.size() > 1 ? paths[1] : nullptr;
+
+    std::cout << "trace: " << paths[0] << " (" << trace.clients.size() << " clients, " << trace.globals.size()
+        << " globals, " << trace.filter_events << " filter calls over " << trace.duration_ns / 1000000 << " ms)"
+        << std::endl;
+    if (trace.dropped) {
+        std::cerr << "warning: the capture dropped " << trace.dropped << " events, the replay is incomplete"
+            << std::endl;
+    }
+    if (trace.unknown_client_calls || trace.chained_denied_calls) {
+        std::cout << "not replayed: " << trace.chained_denied_calls
+            << " filter calls the compositor's own filter denied, " << trace.unknown_client_calls << " from clients wlbouncer did not know" << std::endl;
+    }
+    // Names are looked up once up front, so the lookups are neither timed nor racing the replay
+    for (auto const& credentials : trace.clients) {
+        NameResolver::get().user_now(credentials.uid);
+        NameResolver::get().group_now(credentials.gid);
+    }
+    if (mode == "policy") {
+        PolicyReplay replay{trace, config_file};
+        if (!replay.ok()) {
+            return 1;
+        }
+        report(replay, trace, repeat);
+    } else {
+        // Each pass creates a display, none of which should watch the config
+        setenv("BOUNCER_NO_RELOAD", "1", 1);
+        FilterReplay replay{trace, config_file};
+        report(replay, trace, repeat);
+    }
+    return 0;
+}